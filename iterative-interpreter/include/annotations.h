@@ -0,0 +1,27 @@
+#ifndef ITERATIVE_INTERPRETER_ANNOTATIONS_H
+#define ITERATIVE_INTERPRETER_ANNOTATIONS_H
+
+#include <cstdint>
+#include "arena_allocator.h"
+
+extern "C" {
+#include "bytefile.h"
+}
+
+// Facts about the bytecode proven by the static analyzer (`static-analyzer/build/main --types`):
+// the BINOP, CJMPz and CJMPnz instructions whose operands are always integers.
+// The header of the file names the size and hash of the bytecode it is computed
+// for, the table is rejected for any other; its offsets are validated too.
+class annotations {
+public:
+    annotations(bytefile *file, const char *file_name);
+
+    inline bool integer_operands(int32_t offset) const {
+        return proven[offset];
+    }
+
+private:
+    arena_vector<bool> proven; // in the arena of the bytefile
+};
+
+#endif //ITERATIVE_INTERPRETER_ANNOTATIONS_H
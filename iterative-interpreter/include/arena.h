@@ -0,0 +1,38 @@
+#ifndef ITERATIVE_INTERPRETER_ARENA_H
+#define ITERATIVE_INTERPRETER_ARENA_H
+
+# include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A bump allocator that owns the bytefile, the global area and the tables
+   built for a program at load time. Allocations are laid out one after another
+   in large chunks (mapped by reserve_region, so they are reachable by a value)
+   and are never freed one by one: arena_release frees all of them at once */
+typedef struct arena arena;
+
+/* Every allocation is aligned to this */
+# define ARENA_ALIGN 16
+
+/* Creates an empty arena */
+arena *arena_create (void);
+
+/* Allocates size bytes; fails instead of returning NULL */
+void *arena_alloc (arena *a, size_t size);
+
+/* Bytes allocated so far, the peak size as nothing is freed before arena_release */
+size_t arena_peak (const arena *a);
+
+/* Bytes of address space taken by the chunks */
+size_t arena_reserved (const arena *a);
+
+/* Frees the arena with everything allocated in it */
+void arena_release (arena *a);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //ITERATIVE_INTERPRETER_ARENA_H
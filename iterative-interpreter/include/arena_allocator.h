@@ -0,0 +1,41 @@
+#ifndef ITERATIVE_INTERPRETER_ARENA_ALLOCATOR_H
+#define ITERATIVE_INTERPRETER_ARENA_ALLOCATOR_H
+
+#include <cstddef>
+#include <vector>
+#include "arena.h"
+
+// Allocates the elements of a container in an arena; deallocation does
+// nothing, the memory goes away with the arena
+template<typename T>
+struct arena_allocator {
+    using value_type = T;
+
+    arena *owner;
+
+    explicit arena_allocator(arena *owner) : owner(owner) {}
+
+    template<typename U>
+    arena_allocator(const arena_allocator<U> &other) : owner(other.owner) {}
+
+    T *allocate(size_t n) {
+        return static_cast<T *>(arena_alloc(owner, n * sizeof(T)));
+    }
+
+    void deallocate(T *, size_t) {}
+
+    template<typename U>
+    bool operator==(const arena_allocator<U> &other) const {
+        return owner == other.owner;
+    }
+
+    template<typename U>
+    bool operator!=(const arena_allocator<U> &other) const {
+        return owner != other.owner;
+    }
+};
+
+template<typename T>
+using arena_vector = std::vector<T, arena_allocator<T>>;
+
+#endif //ITERATIVE_INTERPRETER_ARENA_ALLOCATOR_H
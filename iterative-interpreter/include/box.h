@@ -5,19 +5,33 @@
 #ifndef ITERATIVE_INTERPRETER_BOX_H
 #define ITERATIVE_INTERPRETER_BOX_H
 
+extern "C" {
+#include "runtime.h"
+}
+
 namespace boxing {
 
-    static inline int32_t box(int32_t value) {
+    static inline word box(word value) {
         return (value << 1) | 1;
     }
 
-    static inline int32_t unbox(int32_t value) {
+    static inline word unbox(word value) {
         return value >> 1;
     }
 
-    static inline bool is_boxed(int32_t value) {
+    static inline bool is_boxed(word value) {
         return value & 1;
     }
+
+    // A reference as a value and back (see COMPRESS in runtime.h)
+    static inline word compress(const void *pointer) {
+        return COMPRESS(pointer);
+    }
+
+    template<typename T = void>
+    static inline T *decompress(word value) {
+        return static_cast<T *>(DECOMPRESS(value));
+    }
 }
 
 #endif //ITERATIVE_INTERPRETER_BOX_H
@@ -6,21 +6,28 @@
 # include <stdio.h>
 # include <errno.h>
 # include <malloc.h>
+# include <stdint.h>
 # include "runtime.h"
+# include "arena.h"
 
-extern void *__start_custom_data;
-extern void *__stop_custom_data;
+/* The global area of the bytecode being run on the current thread, scanned
+   for roots by the GC; set by the interpreter */
+extern __thread void *__start_custom_data;
+extern __thread void *__stop_custom_data;
 
 /* The unpacked representation of bytecode bf */
 typedef struct {
     char *string_ptr;              /* A pointer to the beginning of the string table */
     int *public_ptr;              /* A pointer to the beginning of publics table    */
     char *code_ptr;                /* A pointer to the bytecode itself               */
-    int *global_ptr;              /* A pointer to the global area                   */
+    word *global_ptr;             /* A pointer to the global area                   */
     int stringtab_size;          /* The size (in bytes) of the string table        */
     int global_area_size;        /* The size (in words) of global area             */
     int public_symbols_number;   /* The number of public symbols                   */
-    char buffer[0];
+    char *file_ptr;                /* A pointer to the read-only mapping of the file */
+    size_t file_size;              /* The size (in bytes) of the mapping             */
+    arena *arena_ptr;              /* Owns the bytefile, the global area and the
+                                      tables built for the program at load time      */
 } bytefile;
 
 /* Gets a string from a string table by an index */
@@ -32,9 +39,25 @@ char *get_public_name(bytefile *f, int i);
 /* Gets an offset for a publie symbol */
 int get_public_offset(bytefile *f, int i);
 
-/* Reads a binary bytecode bf by name and unpacks it */
+/* Maps a binary bytecode bf by name read-only and unpacks it in place;
+   the bytefile is allocated in a new arena */
 bytefile *read_file(char *fname);
 
+/* Moves the mapping of the bytecode bf to address, over whatever is mapped
+   there; returns -1 on failure */
+int move_file(bytefile *f, char *address);
+
+/* FNV-1a hash of the whole file of the bytecode bf, which ties the files
+   computed for it (snapshots, annotations) to its contents */
+uint64_t file_hash(bytefile *f);
+
+/* Unmaps the bytecode bf and releases its arena with everything in it */
+void close_file(bytefile *f);
+
+/* Disassembles the instruction at ip (only decodes it if f is NULL);
+   returns the next one or NULL at STOP */
+char *disassemble_instruction(FILE *f, bytefile *bf, char *ip);
+
 /* Disassembles the bytecode pool */
 void disassemble(FILE *f, bytefile *bf);
 
@@ -0,0 +1,61 @@
+#ifndef ITERATIVE_INTERPRETER_EMBEDDING_H
+#define ITERATIVE_INTERPRETER_EMBEDDING_H
+
+#include <cstdio>
+#include <stdexcept>
+#include "verifier.h"
+
+class iterative_interpreter;
+
+class annotations;
+
+namespace register_ir {
+    class program;
+}
+
+// Running bytecode from a host program. Every vm has its own heap, operand
+// stack, globals and streams, so a process can hold any number of them and
+// run them at the same time, each on its own thread.
+namespace embedding {
+
+    // A failure while loading or running the bytecode, with its message
+    class error : public std::runtime_error {
+    public:
+        using std::runtime_error::runtime_error;
+    };
+
+    struct options {
+        FILE *in = stdin;
+        FILE *out = stdout;
+        bool trusted = false;                  // no runtime type checks, as --trusted
+        bool registers = false;                // run the register form, as --registers
+        const char *annotations = nullptr;     // as --annotations
+    };
+
+    // One program, loaded and verified by the constructor
+    class vm {
+    public:
+        explicit vm(const char *file_name, const options &opts = options());
+
+        ~vm();
+
+        vm(const vm &) = delete;
+
+        vm &operator=(const vm &) = delete;
+
+        // Runs the program to the end and returns the integer returned by its
+        // main function (0 for a reference). A program runs once; after a
+        // failure the vm can only be destroyed.
+        word run();
+
+    private:
+        bytefile *bf = nullptr;
+        verifier::stack_map stacks;
+        annotations *notes = nullptr;
+        register_ir::program *program = nullptr;
+        iterative_interpreter *interpreter = nullptr;
+        bool finished = false;
+    };
+}
+
+#endif //ITERATIVE_INTERPRETER_EMBEDDING_H
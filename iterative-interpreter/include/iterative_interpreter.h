@@ -2,45 +2,171 @@
 #define ITERATIVE_INTERPRETER_ITERATIVE_INTERPRETER_H
 
 #include "stack.h"
+#include "verifier.h"
+#include "arena_allocator.h"
+#include <vector>
 
 extern "C" {
 #include "bytefile.h"
 }
 
+class profiler;
+
+class annotations;
+
+namespace register_ir {
+    class program;
+}
+
+namespace snapshot {
+    struct reservation;
+}
+
+// Enters a runtime context for the lifetime of the scope, and leaves it
+// also when a failure unwinds the scope
+struct context_scope {
+    runtime_context *context;
+
+    explicit context_scope(runtime_context *context) : context(context) {
+        runtime_context_enter(context);
+    }
+
+    ~context_scope() {
+        runtime_context_leave(context);
+    }
+};
+
 class iterative_interpreter {
 public:
-    explicit iterative_interpreter(bytefile *file);
+    // Takes the context the program runs in; nullptr stands for a new one
+    // on stdin and stdout
+    iterative_interpreter(bytefile *file, const verifier::stack_map &stacks, profiler *prof = nullptr,
+                          annotations *notes = nullptr, register_ir::program *registers = nullptr,
+                          runtime_context *context = nullptr);
 
     ~iterative_interpreter();
 
-    void eval();
+    // Runs the program, returns the value left by its main function
+    word eval();
+
+    // Makes eval write a snapshot of the machine to the file name when the
+    // program first reaches the instruction at offset (see snapshot.h), and
+    // run the rest of the program after it
+    void snapshot_at(int32_t offset, const char *name);
+
+    // Continues the program from the snapshot in the file name, taken of a
+    // run of the same bytecode, with the ranges reserved for it before the
+    // bytecode was loaded; eval runs the rest of the program
+    void restore(const char *name, const snapshot::reservation &ranges);
 
 private:
+    runtime_context *context;
     bytefile *bf;
     char *ip;
-    int32_t *fp;
+    word *fp;
+    profiler *prof;
+    annotations *notes;
+    register_ir::program *registers;
+    char *snapshot_ip = nullptr;
+    const char *snapshot_name = nullptr;
+    // The tables below are allocated in the arena of the bytefile
+
+    // by the offset a call returns to: the call is a tail call
+    arena_vector<bool> tail_calls;
+
+    // operands of BEGIN/CBEGIN cached by the offset of the function
+    struct function_info {
+        int32_t nlocals;
+        int32_t depth; // largest operand stack depth within the function
+    };
+    arena_vector<function_info> functions;
+
+    // A chain of DUP; TAG/ARRAY; CJMPz tests of one value, each failing into
+    // the next, as a collision-free hash table keyed by the shape of the value
+    struct decision_table {
+        struct arm {
+            int32_t kind;   // SEXP_TAG or ARRAY_TAG, 0 in empty slots
+            int32_t tag;    // unboxed tag hash of a sexp
+            int32_t arity;
+            int32_t target; // the code after the CJMPz of the test
+        };
+        arena_vector<arm> slots;
+        uint32_t mask;
+        int32_t otherwise;  // where the last test fails to
+    };
+    arena_vector<decision_table> decisions;
+    // by the offset of the DUP starting a chain, -1 elsewhere
+    arena_vector<int32_t> decision_at;
+
+    // operands of SEXP and TAG resolved at load time
+    struct sexp_info {
+        word tag;     // boxed tag hash
+        word header;  // of a packed sexp of this shape, 0 if it is not packed
+        int32_t n;
+        bool cons;    // a cons cell of a list
+    };
+    arena_vector<sexp_info> sexps;
+    // by the offset of a SEXP or TAG instruction, -1 elsewhere
+    arena_vector<int32_t> sexp_at;
+
+    template<bool profile>
+    void run();
+
+    // Executes the instruction at ip, returns false at STOP. With fuse, a
+    // test directly followed by CJMPz/CJMPnz takes the branch itself and
+    // executes the jump too
+    template<bool fuse>
+    bool step();
+
+    void run_registers();
+
+    // Runs up to the snapshot point and takes the snapshot there, returns
+    // false if the program ends before it
+    bool run_to_snapshot();
 
     //util
     void jmp(int32_t addr);
 
-    int32_t *lookup(char l, int32_t i);
+    word *lookup(char l, int32_t i);
 
-    int32_t *binded(int32_t i);
+    word *binded(int32_t i);
 
-    int32_t *args(int32_t i);
+    word *args(int32_t i);
 
-    int32_t *local(int32_t i);
+    word *local(int32_t i);
 
-    int32_t *global(int32_t i);
+    word *global(int32_t i);
+
+    void reuse_frame(int32_t words);
+
+    void enter(int32_t addr);
+
+    void find_decisions(int32_t offset);
+
+    void resolve_sexp(int32_t offset);
+
+    bool integer_operands();
 
     //eval
     void eval_binop(char op);
 
+    template<bool integers>
+    void eval_add();
+
+    template<bool integers>
+    void eval_sub();
+
+    template<bool integers>
+    void eval_mul();
+
+    template<bool fuse, typename compare>
+    void eval_compare();
+
     void eval_const(int32_t value);
 
     void eval_string(char *str);
 
-    void eval_sexp(char *name, int n);
+    void eval_sexp(const sexp_info &sexp);
 
     void eval_sta();
 
@@ -52,6 +178,8 @@ private:
 
     void eval_dup();
 
+    void eval_match(const decision_table &table);
+
     void eval_swap();
 
     void eval_elem();
@@ -74,7 +202,8 @@ private:
 
     void eval_call(int32_t addr, int32_t argc);
 
-    void eval_tag(char *name, int32_t n);
+    template<bool fuse>
+    void eval_tag(const sexp_info &sexp);
 
     void eval_array(int32_t n);
 
@@ -82,7 +211,10 @@ private:
 
     void eval_line(int32_t b);
 
-    void eval_patt(char l);
+    template<bool fuse, typename test>
+    void eval_patt();
+
+    void eval_patt_string();
 
     void eval_call_lread();
 
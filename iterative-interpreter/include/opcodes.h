@@ -0,0 +1,67 @@
+#ifndef ITERATIVE_INTERPRETER_OPCODES_H
+#define ITERATIVE_INTERPRETER_OPCODES_H
+
+#define STOP           0xF
+#define BINOP          0x0
+#define BINOP_ADD      0x01
+#define BINOP_SUB      0x02
+#define BINOP_PROD     0x03
+#define BINOP_DIV      0x04
+#define BINOP_MOD      0x05
+#define BINOP_LESS     0x06
+#define BINOP_ELESS    0x07
+#define BINOP_GREATER  0x08
+#define BINOP_EGREATER 0x09
+#define BINOP_EQUAL    0x0A
+#define BINOP_NEQUAL   0x0B
+#define BINOP_AND      0x0C
+#define BINOP_OR       0x0D
+#define BLOCK_DATE     0x1
+#define BLOCK_CONST    0x10
+#define BLOCK_STRING   0x11
+#define BLOCK_SEXP     0x12
+#define BLOCK_STI      0x13
+#define BLOCK_STA      0x14
+#define BLOCK_JMP      0x15
+#define BLOCK_END      0x16
+#define BLOCK_RET      0x17
+#define BLOCK_DROP     0x18
+#define BLOCK_DUP      0x19
+#define BLOCK_SWAP     0x1A
+#define BLOCK_ELEM     0x1B
+#define LD             0x2
+#define LDA            0x3
+#define ST             0x4
+#define BLOCK_MOVE     0x5
+#define CJMPZ          0x50
+#define CJMPNZ         0x51
+#define BEGIN          0x52
+#define CBEGIN         0x53
+#define CLOSUSRE       0x54
+#define CALLC          0x55
+#define CALL           0x56
+#define PLACE_TAG      0x57
+#define ARRAY          0x58
+#define CALL_FAIL      0x59
+#define LINE           0x5A
+#define PATT           0x6
+#define PATT_BSTRING   0x60
+#define PATT_BSTRING_T 0x61
+#define PATT_BARRAY_T  0x62
+#define PATT_BSEXP_T   0x63
+#define PATT_BBOXED    0x64
+#define PATT_BUNBOXED  0x65
+#define PATT_BCLOSURE_T 0x66
+#define BLOCK_CALL     0x7
+#define CALL_LREAD     0x70
+#define CALL_LWRITE    0x71
+#define CALL_LLENGTH   0x72
+#define CALL_LSRTING   0x73
+#define CALL_BARRAY    0x74
+
+#define GLOBAL 0
+#define LOCAL 1
+#define ARGS 2
+#define BINDED 3
+
+#endif //ITERATIVE_INTERPRETER_OPCODES_H
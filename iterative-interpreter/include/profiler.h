@@ -0,0 +1,112 @@
+#ifndef ITERATIVE_INTERPRETER_PROFILER_H
+#define ITERATIVE_INTERPRETER_PROFILER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <x86intrin.h>
+#include "arena_allocator.h"
+
+extern "C" {
+#include "bytefile.h"
+}
+
+// Cycles are measured for one instruction out of PROFILE_SAMPLE_PERIOD on average
+const int PROFILE_SAMPLE_PERIOD = 64;
+
+// Number of rows in every section of the report
+const int PROFILE_REPORT_LIMIT = 20;
+
+// Upper bound on the number of distinct opcodes, used to index n-gram tables
+const int NGRAM_ALPHABET = 64;
+
+class profiler {
+public:
+    explicit profiler(bytefile *file, bool ngrams = false);
+
+    // Called by the interpreter before every instruction
+    inline void enter(char *ip) {
+        int32_t offset = ip - bf->code_ptr;
+        counts[offset]++;
+        if (ngrams) {
+            record_ngrams(offset);
+        }
+        if (--countdown == 0) {
+            sampled = offset;
+            sample_start = __rdtsc();
+        }
+    }
+
+    // Called by the interpreter after every instruction except STOP
+    inline void leave() {
+        if (sampled >= 0) {
+            cycles[sampled] += (__rdtsc() - sample_start) * PROFILE_SAMPLE_PERIOD;
+            sampled = -1;
+            countdown = next_countdown();
+        }
+    }
+
+    void report(FILE *f);
+
+    // Writes opcode bigram and trigram counts in the format merged by the static analyzer
+    void write_ngrams(FILE *f);
+
+private:
+    bytefile *bf;
+    int32_t code_size;
+
+    // per bytecode offset; the counters are in the arena of the bytefile
+    arena_vector<uint64_t> counts;
+    arena_vector<uint64_t> cycles;
+
+    // opcode n-grams of dynamically consecutive instructions, where the second
+    // one is the fall-through successor of the first (so they could be fused)
+    bool ngrams;
+    arena_vector<int32_t> next_offset;
+    int16_t dense[256];
+    std::vector<uint8_t> opcode_bytes;
+    std::vector<std::string> opcode_names;
+    arena_vector<uint64_t> bigrams;
+    arena_vector<uint64_t> trigrams;
+    int32_t expected;
+    int32_t prev1;
+    int32_t prev2;
+
+    inline void record_ngrams(int32_t offset) {
+        int32_t op = dense[(uint8_t) bf->code_ptr[offset]];
+        if (offset == expected) {
+            bigrams[prev1 * NGRAM_ALPHABET + op]++;
+            if (prev2 >= 0) {
+                trigrams[(prev2 * NGRAM_ALPHABET + prev1) * NGRAM_ALPHABET + op]++;
+            }
+            prev2 = prev1;
+        } else {
+            prev2 = -1;
+        }
+        prev1 = op;
+        expected = next_offset[offset];
+    }
+
+    void write_ngrams(FILE *f, int n, const arena_vector<uint64_t> &table);
+
+    int32_t countdown;
+    int32_t sampled;
+    uint64_t sample_start;
+    uint32_t seed;
+
+    int32_t next_countdown();
+
+    std::string describe(char *ip);
+
+    std::string opcode_name(char *ip);
+
+    void report_opcodes(FILE *f);
+
+    void report_functions(FILE *f);
+
+    void report_loops(FILE *f);
+
+    void report_instructions(FILE *f);
+};
+
+#endif //ITERATIVE_INTERPRETER_PROFILER_H
@@ -0,0 +1,81 @@
+#ifndef ITERATIVE_INTERPRETER_REGISTER_IR_H
+#define ITERATIVE_INTERPRETER_REGISTER_IR_H
+
+#include <cstdint>
+#include <vector>
+#include "verifier.h"
+#include "arena_allocator.h"
+
+class annotations;
+
+// A register form of the bytecode, built at load time. Frames keep the layout
+// of the stack interpreter, and every operand stack slot lives at a fixed
+// position in the frame (the verifier guarantees a static stack depth), so
+// locals, args and stack slots are all addressed as fp[k]:
+//   args(i) = fp[i + 3], local(i) = fp[-i - 1], stack slot d = fp[-nlocals - d - 1].
+// The return address in fp[2] is the index of the instruction to return to.
+// __gc_stack_top is only brought up to date before the instructions that can
+// allocate or call, which are the only points a collection can happen.
+namespace register_ir {
+
+    enum opcode : uint8_t {
+        IR_MOV,      // fp[dst] = fp[a]
+        IR_LOADI,    // fp[dst] = box(a)
+        IR_LOADG,    // fp[dst] = global(a)
+        IR_STOREG,   // global(dst) = fp[a]
+        IR_ADD,      // fp[dst] = fp[a] + fp[b], on the tagged representation, for proven integer operands
+        IR_SUB,
+        IR_MUL,
+        IR_CMP,      // fp[dst] = box(fp[a] <cmp> fp[b]), cmp is the BINOP operator
+        IR_BINOP,    // fp[dst] = fp[a] <cmp> fp[b] through unboxing, for / % && !! and unproven + - *
+        IR_JMP,      // goto dst
+        IR_CJMPZ,    // if unbox(fp[a]) == 0 goto dst
+        IR_CJMPNZ,
+        IR_JCMPZ,    // if !(fp[a] <cmp> fp[b]) goto dst
+        IR_JCMPNZ,   // if fp[a] <cmp> fp[b] goto dst
+        IR_SWAP,     // exchange fp[a] and fp[b]
+        IR_BEGIN,    // frame setup: a = nlocals, b = number of stack slots
+        IR_END,      // return fp[a]
+        IR_CALL,     // call the function at instruction dst with a arguments, stack top at fp + b
+        IR_CALLC,    // call the closure below a arguments, stack top at fp + b
+        IR_TAIL_CALL, // CALL and END in one, the callee takes over the frame
+        IR_TAIL_CALLC,
+        IR_STACK,    // run the bytecode instruction at offset on the operand stack, stack top at fp + b
+        IR_STOP
+    };
+
+    struct instruction {
+        opcode op;
+        uint8_t cmp;   // BINOP operator of CMP, BINOP, JCMPZ and JCMPNZ
+        int32_t offset; // of the bytecode instruction it comes from
+        int32_t dst;
+        int32_t a;
+        int32_t b;
+    };
+
+    class program {
+    public:
+        // Translates every function of verified bytecode
+        program(bytefile *bf, const verifier::stack_map &stacks, const annotations *notes);
+
+        instruction *entry(int32_t offset) {
+            return code.data() + entries[offset];
+        }
+
+        instruction *at(int32_t index) {
+            return code.data() + index;
+        }
+
+        int32_t size() const {
+            return code.size();
+        }
+
+    private:
+        // in the arena of the bytefile
+        arena_vector<instruction> code;
+        // instruction index of the BEGIN of the function at a bytecode offset
+        arena_vector<int32_t> entries;
+    };
+}
+
+#endif //ITERATIVE_INTERPRETER_REGISTER_IR_H
@@ -13,9 +13,66 @@
 # include <time.h>
 # include <limits.h>
 # include <ctype.h>
+# include <stdint.h>
 
 # define WORD_SIZE (CHAR_BIT * sizeof(int))
 
+/* A value: a boxed integer or a reference. Normally it has the size of a
+   pointer; with COMPRESSED_REFS a 64-bit build keeps 32-bit values, and all the
+   memory a value can refer to (heap, operand stack, globals and the bytecode)
+   is mapped into the low 2GB, so a reference is its address truncated to 32 bits */
+# ifdef COMPRESSED_REFS
+typedef int32_t word;
+typedef uint32_t uword;
+#  define REGION_FLAGS MAP_32BIT
+# else
+typedef intptr_t word;
+typedef uintptr_t uword;
+#  define REGION_FLAGS 0
+# endif
+
+/* A reference as a value and back */
+# define COMPRESS(p)   ((word) (intptr_t) (p))
+# define DECOMPRESS(x) ((void*) (intptr_t) (x))
+
 void failure (const char *s, ...);
 
+/* Type checks of runtime primitives (ASSERT_* in runtime.c); cleared for trusted bytecode */
+extern __thread int runtime_checks;
+
+/* A virtual machine: the heap, the operand stack and the roots of a program,
+   its global area, streams and checks. The runtime works with the machine
+   entered on the current thread and keeps its state in thread-local
+   variables, so machines on different threads run independently */
+typedef struct runtime_context runtime_context;
+
+/* A machine reading from in and writing to out. If on_failure is not NULL, a
+   failure calls it with the message instead of ending the process; it is
+   not expected to return (a C++ host throws from it) */
+runtime_context *runtime_context_create (FILE *in, FILE *out, int checks,
+                                         void (*on_failure) (const char *message));
+
+/* Makes c the machine of the current thread; a thread runs one at a time */
+void runtime_context_enter (runtime_context *c);
+
+/* Saves the state of the machine of the current thread to c */
+void runtime_context_leave (runtime_context *c);
+
+/* Frees c; the heap is released by __shutdown and the stack by the interpreter */
+void runtime_context_destroy (runtime_context *c);
+
+/* Reserves size bytes of address space between two inaccessible guard areas of
+   guard bytes each; pages are committed by the kernel on first touch. The
+   region is reachable by a value (see REGION_FLAGS) */
+void *reserve_region (size_t size, size_t guard);
+
+/* Releases a region returned by reserve_region */
+void release_region (void *begin, size_t size, size_t guard);
+
+/* While enabled, the regions released on the current thread keep their
+   address space and are handed out again by reserve_region, so machines run
+   one after another on a thread reuse the heap and the stack of the previous
+   one. Disabling releases the kept regions */
+void runtime_cache_regions (int enable);
+
 # endif
\ No newline at end of file
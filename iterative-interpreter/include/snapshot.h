@@ -0,0 +1,48 @@
+#ifndef ITERATIVE_INTERPRETER_SNAPSHOT_H
+#define ITERATIVE_INTERPRETER_SNAPSHOT_H
+
+#include <cstdint>
+
+extern "C" {
+#include "bytefile.h"
+}
+
+// A snapshot is the state of a machine stopped between two instructions of the
+// stack interpreter: its global area, operand stack, heap and position in the
+// code. The heap and the bytecode are mapped back at the addresses they had, so
+// references in the heap stay valid as they are; the global area and the stack
+// are copied, and the addresses into them found on the stack are moved.
+// The file is a header, the global area, the stack (bottom last) and, from a
+// page boundary on, the used part of the heap, which a restore maps lazily
+namespace snapshot {
+
+    // Where the program stopped
+    struct position {
+        char *ip;
+        word *fp;
+    };
+
+    // The address ranges of the heap and of the bytecode of a snapshot, taken
+    // before anything else of the machine is mapped, so that nothing lands there
+    struct reservation {
+        char *bytecode;
+        size_t bytecode_size;
+        word *heap;
+        size_t heap_size;
+    };
+
+    // Writes the machine entered on the current thread, which runs bf, to the
+    // file name; collects the garbage first
+    void write(const char *name, bytefile *bf, position at);
+
+    // Reserves the ranges for the snapshot in the file name, fails if another
+    // mapping of the process is there already
+    reservation reserve(const char *name);
+
+    // Loads the snapshot from the file name into the ranges reserved for it and
+    // into the machine entered on the current thread, which runs the same
+    // bytecode bf and has not run yet; returns where the program goes on
+    position read(const char *name, const reservation &ranges, bytefile *bf);
+}
+
+#endif //ITERATIVE_INTERPRETER_SNAPSHOT_H
@@ -6,37 +6,159 @@ extern "C" {
 };
 
 #include "utility"
+#include <algorithm>
+#include <cstdlib>
+#include <unistd.h>
+#include <signal.h>
+#include <setjmp.h>
 #include "box.h"
-//#define DEBUG_PRINT 1
 
-extern int32_t *__gc_stack_top, *__gc_stack_bottom;
+extern __thread word *__gc_stack_top, *__gc_stack_bottom;
 
 const int STACK_CAPACITY = sizeof(int32_t) * (1 << 23);
 
 namespace stack {
 
-    inline int32_t *get_stack_bottom() {
+    inline word *get_stack_bottom() {
         return __gc_stack_bottom;
     }
 
-    inline int32_t *get_stack_max_top() {
+    inline word *get_stack_max_top() {
         return __gc_stack_bottom - STACK_CAPACITY;
     }
 
-    inline int32_t *get_stack_top() {
+    inline word *get_stack_top() {
         return __gc_stack_top;
     }
 
-    inline void set_stack_top(int32_t *value) {
+    inline void set_stack_top(word *value) {
         __gc_stack_top = value;
     }
 
+    inline size_t guard_size() {
+        static const size_t size = sysconf(_SC_PAGESIZE);
+        return size;
+    }
+
+    // Where a guard hit of the current thread goes, set for the time of a run
+    inline thread_local sigjmp_buf *guard_point = nullptr;
+
+    enum guard_fault {
+        GUARD_PUSH = 1,
+        GUARD_POP
+    };
+
+    // push and pop do not check bounds: running off either end of the stack
+    // hits a guard page, and the handler jumps back to the guard point with the
+    // fault, which is reported there. Nothing is reported from the handler
+    // itself: failure() may throw or print, neither is safe in it.
+    // Operand stack underflow within a frame is ruled out by the verifier.
+    inline void guard_handler(int sig, siginfo_t *info, void *context) {
+        auto addr = reinterpret_cast<char *>(info->si_addr);
+        auto max_top = reinterpret_cast<char *>(get_stack_max_top());
+        auto bottom = reinterpret_cast<char *>(get_stack_bottom());
+
+        int fault = 0;
+        if (addr < max_top && addr >= max_top - guard_size()) {
+            fault = GUARD_PUSH;
+        } else if (addr >= bottom && addr < bottom + guard_size()) {
+            fault = GUARD_POP;
+        }
+        if (fault != 0 && guard_point != nullptr) {
+            siglongjmp(*guard_point, fault);
+        }
+
+        // not a stack guard hit or no run to go back to: the fault is re-raised
+        // with the default action
+        struct sigaction action = {};
+        action.sa_handler = SIG_DFL;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGSEGV, &action, nullptr);
+    }
+
+    // Reports a fault the guard point got from the handler
+    [[noreturn]] inline void guard_failure(int fault) {
+        if (fault == GUARD_PUSH) {
+            failure("STACK: push - not enough empty space\n");
+        }
+        failure("STACK: pop - stack is empty\n");
+        abort();
+    }
+
+    // Makes point the guard point of the current thread while it lives; the
+    // point is to be set with sigsetjmp(point, 1), so that the jump unblocks
+    // SIGSEGV again
+    class guard_scope {
+    public:
+        explicit guard_scope(sigjmp_buf &point) : saved(guard_point) {
+            guard_point = &point;
+        }
+
+        ~guard_scope() {
+            guard_point = saved;
+        }
+
+        guard_scope(const guard_scope &) = delete;
+        guard_scope &operator=(const guard_scope &) = delete;
+
+    private:
+        sigjmp_buf *saved;
+    };
+
+    // The handler runs on a stack of its own, one per thread, which is
+    // released when the thread ends
+    class signal_stack {
+    public:
+        signal_stack() {
+            stack_t current;
+            if (sigaltstack(nullptr, &current) == 0 && !(current.ss_flags & SS_DISABLE)) {
+                return; // the thread has one already
+            }
+            stack_t ss = {};
+            ss.ss_size = std::max<size_t>(SIGSTKSZ, 64 * 1024);
+            ss.ss_sp = malloc(ss.ss_size);
+            if (ss.ss_sp != nullptr && sigaltstack(&ss, nullptr) == 0) {
+                memory = ss.ss_sp;
+            } else {
+                free(ss.ss_sp);
+            }
+        }
+
+        ~signal_stack() {
+            if (memory != nullptr) {
+                stack_t ss = {};
+                ss.ss_flags = SS_DISABLE;
+                sigaltstack(&ss, nullptr);
+                free(memory);
+            }
+        }
+
+        signal_stack(const signal_stack &) = delete;
+        signal_stack &operator=(const signal_stack &) = delete;
+
+    private:
+        void *memory = nullptr;
+    };
+
     inline void init() {
-        __gc_stack_bottom = __gc_stack_top = (new int32_t[STACK_CAPACITY]) + STACK_CAPACITY;
+        void *region = reserve_region(STACK_CAPACITY * sizeof(word), guard_size());
+        if (region == MAP_FAILED) {
+            failure("STACK: init - unable to reserve %d words\n", STACK_CAPACITY);
+        }
+        __gc_stack_bottom = __gc_stack_top = reinterpret_cast<word *>(region) + STACK_CAPACITY;
+
+        static thread_local signal_stack handler_stack;
+
+        // the handler serves the stacks of all machines and stays installed
+        struct sigaction action = {};
+        action.sa_sigaction = guard_handler;
+        action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGSEGV, &action, nullptr);
     }
 
     inline void clear() {
-        delete[] get_stack_max_top();
+        release_region(get_stack_max_top(), STACK_CAPACITY * sizeof(word), guard_size());
     }
 
     inline size_t empty_size() {
@@ -48,63 +170,44 @@ namespace stack {
     }
 
     inline void reverse(int32_t n) {
-        if (size() < n) {
-            failure("STACK: reverse: stack is too small, size=%d, n=%d\n", size(), n);
-        }
-        int32_t *top = __gc_stack_top;
-        int32_t *bot = top + n - 1;
+        word *top = __gc_stack_top;
+        word *bot = top + n - 1;
         while (top < bot) {
             std::swap(*(top++), *(bot--));
         }
     }
 
-    inline int32_t pop() {
-        if (size() < 1) {
-            failure("STACK: pop - stack is empty\n");
-        }
-#ifdef DEBUG_PRINT
-        printf("stack: pop - %d\n", *__gc_stack_top);
-#endif
+    inline word pop() {
         return *(__gc_stack_top++);
     }
 
-    inline int32_t peek(int32_t index = 0) {
-        if (size() < index) {
-            failure("STACK: peek - index is too large\n");
-        }
+    inline word &top() {
+        return *__gc_stack_top;
+    }
 
+    inline word peek(int32_t index = 0) {
         return __gc_stack_top[index];
     }
 
-    inline void push(int32_t value) {
-        if (empty_size() < 1) {
-            failure("STACK: push - not enough empty space\n");
-        }
-#ifdef DEBUG_PRINT
-        printf("stack: push - %d\n", value);
-#endif
-
+    inline void push(word value) {
         *(--__gc_stack_top) = value;
     }
 
-    inline int32_t unbox_pop() {
+    inline word unbox_pop() {
         return boxing::unbox(pop());
     }
 
-    inline void push_box(int32_t value) {
+    inline void push_box(word value) {
         push(boxing::box(value));
     }
 
     inline void drop(int32_t n) {
-        if (size() < n) {
-            failure("STACK: drop: stack is too small\n");
-        }
-
         __gc_stack_top += n;
     }
 
-    inline void reserve(int32_t n) {
-        if (empty_size() < n) {
+    // Takes n slots, making sure that headroom more slots are free after them
+    inline void reserve(int32_t n, int32_t headroom = 0) {
+        if (empty_size() < n + headroom) {
             failure("STACK: reserve - not enough empty space\n");
         }
         __gc_stack_top -= n;
@@ -0,0 +1,51 @@
+#ifndef ITERATIVE_INTERPRETER_VERIFIER_H
+#define ITERATIVE_INTERPRETER_VERIFIER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "bytefile.h"
+}
+
+namespace verifier {
+
+    const char VALUE = 'v';
+    const char ADDRESS = 'a';
+
+    // The abstract operand stack before every reachable instruction, bottom first:
+    // ADDRESS for the slots filled by LDA, VALUE for the others
+    class stack_map {
+    public:
+        bool reachable(int32_t offset) const {
+            return index[offset] >= 0 && visited[index[offset]];
+        }
+
+        const std::string &before(int32_t offset) const {
+            return states[index[offset]];
+        }
+
+        // A CALL or CALLC that END follows directly and that passes no variable
+        // addresses (they may point into the frame), so it can reuse the frame
+        bool tail_call(int32_t offset) const {
+            return index[offset] >= 0 && tail_calls[index[offset]];
+        }
+
+    private:
+        friend class bytecode_verifier;
+
+        // instruction number of each instruction start, -1 inside instructions
+        std::vector<int32_t> index;
+        std::vector<std::string> states;
+        std::vector<bool> visited;
+        std::vector<bool> tail_calls;
+    };
+
+    // Checks the bytecode before it is run: opcodes and their operands, jump and
+    // call targets, string and global indices, and that every function keeps the
+    // operand stack balanced. Reports the first problem with failure().
+    stack_map verify(bytefile *bf);
+}
+
+#endif //ITERATIVE_INTERPRETER_VERIFIER_H
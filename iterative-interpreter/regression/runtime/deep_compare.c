@@ -0,0 +1,51 @@
+/* Compares and hashes lists of a million elements through the runtime, the
+   way the compare and hash builtins of Std do; a recursive Lcompare used to
+   run out of the C stack on them */
+
+# include "runtime.h"
+# include "runtime_common.h"
+
+# define LENGTH 1000000
+
+extern void  __init   (void);
+extern void *Bcons    (word *top);
+extern word  Lcompare (void *p, void *q);
+extern word  Lhash    (void *p);
+
+extern __thread size_t __gc_stack_top, __gc_stack_bottom;
+
+/* The roots of the collector: the tail and the head of the cell being built
+   (in the order Bcons takes them) and the two lists compared */
+static word roots[4];
+
+/* The list 0, 1, ..., LENGTH - 2, last */
+static word build (int last) {
+    int i;
+
+    roots[0] = BOX(0);
+    for (i = LENGTH - 1; i >= 0; i--) {
+        roots[1] = BOX(i == LENGTH - 1 ? last : i);
+        roots[0] = COMPRESS(Bcons (roots));
+    }
+    return roots[0];
+}
+
+static int sign (word c) {
+    return UNBOX(c) < 0 ? -1 : UNBOX(c) > 0;
+}
+
+int main (void) {
+    __init ();
+    __gc_stack_top    = (size_t) roots;
+    __gc_stack_bottom = (size_t) (roots + 4);
+
+    roots[2] = build (LENGTH - 1);
+    roots[3] = build (LENGTH - 1);
+    printf ("%d\n", sign (Lcompare (DECOMPRESS(roots[2]), DECOMPRESS(roots[3]))));
+    printf ("%d\n", Lhash (DECOMPRESS(roots[2])) == Lhash (DECOMPRESS(roots[3])));
+
+    roots[3] = build (LENGTH);
+    printf ("%d\n", sign (Lcompare (DECOMPRESS(roots[2]), DECOMPRESS(roots[3]))));
+    printf ("%d\n", sign (Lcompare (DECOMPRESS(roots[3]), DECOMPRESS(roots[2]))));
+    return 0;
+}
@@ -1,4 +1,8 @@
 make check
 pushd expressions && make check && popd
 pushd deep-expressions && make check && popd
+pushd runtime && make check && popd
+pushd verifier && make check && popd
+pushd batch && make check && popd
+pushd snapshot && make check && popd
 pushd x86only && make check && popd
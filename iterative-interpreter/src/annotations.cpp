@@ -0,0 +1,48 @@
+#include "annotations.h"
+#include "opcodes.h"
+
+annotations::annotations(bytefile *file, const char *file_name) : proven(arena_allocator<bool>(file->arena_ptr)) {
+    int32_t code_size = file->file_ptr + file->file_size - file->code_ptr;
+    proven.assign(code_size, false);
+
+    std::vector<bool> starts(code_size, false);
+    for (char *ip = file->code_ptr; ip != nullptr && ip < file->code_ptr + code_size;) {
+        starts[ip - file->code_ptr] = true;
+        ip = disassemble_instruction(nullptr, file, ip);
+    }
+
+    FILE *f = fopen(file_name, "r");
+    if (f == nullptr) {
+        failure("%s: %s\n", file_name, strerror(errno));
+    }
+
+    // the offsets only mean something in the file they are computed for
+    char line[256];
+    size_t size;
+    unsigned long long hash;
+    if (fgets(line, sizeof(line), f) == nullptr
+        || sscanf(line, "# lama integer operands of %zu bytes, hash %llx", &size, &hash) != 2) {
+        failure("%s: no \"# lama integer operands\" header\n", file_name);
+    }
+    if (size != file->file_size || hash != file_hash(file)) {
+        failure("%s: the annotations are computed for another bytecode file\n", file_name);
+    }
+
+    while (fgets(line, sizeof(line), f) != nullptr) {
+        if (line[0] == '#' || line[0] == '\n') continue;
+
+        unsigned offset;
+        if (sscanf(line, "0x%x", &offset) != 1) {
+            failure("%s: malformed line \"%s\"\n", file_name, line);
+        }
+        if (offset >= (unsigned) code_size || !starts[offset]) {
+            failure("%s: 0x%.8x is not an instruction\n", file_name, offset);
+        }
+        char x = file->code_ptr[offset];
+        if ((x & 0xF0) >> 4 != BINOP && x != CJMPZ && x != CJMPNZ) {
+            failure("%s: 0x%.8x is not BINOP, CJMPz or CJMPnz\n", file_name, offset);
+        }
+        proven[offset] = true;
+    }
+    fclose(f);
+}
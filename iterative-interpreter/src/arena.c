@@ -0,0 +1,93 @@
+/* Per-program arena of load-time allocations */
+
+# include "arena.h"
+# include "runtime.h"
+
+/* Chunks are taken at least this large; the pages are committed on first touch */
+# define ARENA_CHUNK_SIZE (4 * 1024 * 1024)
+
+typedef struct chunk {
+    struct chunk *next;
+    size_t        size;   /* of the whole chunk, this header included */
+} chunk;
+
+/* The arena lives in its first chunk */
+struct arena {
+    chunk  *chunks;
+    char   *current;
+    char   *end;
+    size_t  allocated;
+    size_t  reserved;
+};
+
+# define ALIGN_UP(x) (((x) + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1))
+
+static chunk *new_chunk (size_t size) {
+    chunk *c = (chunk*) reserve_region (size, 0);
+
+    if (c == MAP_FAILED) {
+        failure ("ARENA: unable to reserve %zu bytes\n", size);
+    }
+    c->size = size;
+    return c;
+}
+
+extern arena *arena_create (void) {
+    chunk *c = new_chunk (ARENA_CHUNK_SIZE);
+    arena *a = (arena*) ((char*) c + ALIGN_UP(sizeof (chunk)));
+
+    c->next      = NULL;
+    a->chunks    = c;
+    a->current   = (char*) a + ALIGN_UP(sizeof (arena));
+    a->end       = (char*) c + c->size;
+    a->allocated = 0;
+    a->reserved  = c->size;
+    return a;
+}
+
+extern void *arena_alloc (arena *a, size_t size) {
+    char *p;
+
+    size = ALIGN_UP(size);
+    if ((size_t) (a->end - a->current) < size) {
+        size_t need = ALIGN_UP(sizeof (chunk)) + size;
+        chunk *c    = new_chunk (need > ARENA_CHUNK_SIZE ? need : ARENA_CHUNK_SIZE);
+
+        a->reserved += c->size;
+        /* a large allocation takes a chunk of its own, and the smaller ones
+           go on filling the current chunk */
+        if (need > ARENA_CHUNK_SIZE) {
+            c->next          = a->chunks->next;
+            a->chunks->next  = c;
+            a->allocated    += size;
+            return (char*) c + ALIGN_UP(sizeof (chunk));
+        }
+        c->next    = a->chunks;
+        a->chunks  = c;
+        a->current = (char*) c + ALIGN_UP(sizeof (chunk));
+        a->end     = (char*) c + c->size;
+    }
+
+    p             = a->current;
+    a->current   += size;
+    a->allocated += size;
+    return p;
+}
+
+extern size_t arena_peak (const arena *a) {
+    return a->allocated;
+}
+
+extern size_t arena_reserved (const arena *a) {
+    return a->reserved;
+}
+
+extern void arena_release (arena *a) {
+    chunk *c = a->chunks;
+
+    while (c != NULL) {
+        chunk *next = c->next;
+        release_region (c, c->size, 0);
+        c = next;
+    }
+}
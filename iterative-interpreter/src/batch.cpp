@@ -0,0 +1,144 @@
+#include "embedding.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Runs many bytecode programs in one process on a fixed pool of threads.
+// Every line of the list is a program and, optionally, the file it reads;
+// the output of file.bc goes to file.log, as in the regression tests.
+
+using batch_clock = std::chrono::steady_clock;
+
+namespace {
+    struct job {
+        std::string program;
+        std::string input;
+        std::string output;
+        double ms = 0;
+        bool failed = false;
+        std::string message;
+    };
+
+    double elapsed_ms(batch_clock::time_point from, batch_clock::time_point to) {
+        return std::chrono::duration<double, std::milli>(to - from).count();
+    }
+
+    std::vector<job> read_list(const char *file_name) {
+        FILE *f = fopen(file_name, "r");
+        if (f == nullptr) {
+            failure("%s: %s\n", file_name, strerror(errno));
+        }
+        std::vector<job> jobs;
+        char line[4096];
+        while (fgets(line, sizeof(line), f) != nullptr) {
+            char program[4096], input[4096];
+            int fields = sscanf(line, "%4095s %4095s", program, input);
+            if (fields < 1 || program[0] == '#') continue;
+
+            job j;
+            j.program = program;
+            j.input = fields == 2 ? input : "/dev/null";
+            size_t ext = j.program.rfind(".bc");
+            j.output = (ext != std::string::npos && ext + 3 == j.program.size() ? j.program.substr(0, ext)
+                                                                                 : j.program) + ".log";
+            jobs.push_back(j);
+        }
+        fclose(f);
+        return jobs;
+    }
+
+    void run_job(job &j, const embedding::options &defaults) {
+        auto start = batch_clock::now();
+        FILE *in = fopen(j.input.c_str(), "r");
+        FILE *out = in != nullptr ? fopen(j.output.c_str(), "w") : nullptr;
+        if (in == nullptr || out == nullptr) {
+            j.failed = true;
+            j.message = std::string(in == nullptr ? j.input : j.output) + ": " + strerror(errno) + "\n";
+        } else {
+            embedding::options opts = defaults;
+            opts.in = in;
+            opts.out = out;
+            try {
+                embedding::vm vm(j.program.c_str(), opts);
+                vm.run();
+            } catch (embedding::error &e) {
+                j.failed = true;
+                j.message = e.what();
+            } catch (std::exception &e) {
+                // out of memory in the arena or a table, say: the program
+                // fails, the other ones of the batch go on
+                j.failed = true;
+                j.message = std::string("unexpected exception: ") + e.what();
+            } catch (...) {
+                j.failed = true;
+                j.message = "unexpected exception";
+            }
+        }
+        if (in != nullptr) fclose(in);
+        if (out != nullptr) fclose(out);
+        j.ms = elapsed_ms(start, batch_clock::now());
+    }
+}
+
+int main(int argc, char *argv[]) {
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    embedding::options defaults;
+    char *list_name = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--registers") == 0) {
+            defaults.registers = true;
+        } else if (strcmp(argv[i], "--trusted") == 0) {
+            defaults.trusted = true;
+        } else {
+            list_name = argv[i];
+        }
+    }
+    if (list_name == nullptr) {
+        failure("usage: %s [--threads <n>] [--registers] [--trusted] <list>\n", argv[0]);
+    }
+
+    std::vector<job> jobs = read_list(list_name);
+    std::atomic<size_t> next(0);
+    auto start = batch_clock::now();
+
+    // every worker runs its programs one after another, and the heap and the
+    // stack of one program are kept for the next one
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; t++) {
+        workers.emplace_back([&] {
+            runtime_cache_regions(1);
+            for (size_t i = next++; i < jobs.size(); i = next++) {
+                run_job(jobs[i], defaults);
+            }
+            runtime_cache_regions(0);
+        });
+    }
+    for (auto &w: workers) {
+        w.join();
+    }
+    double total_ms = elapsed_ms(start, batch_clock::now());
+
+    size_t failed = 0;
+    for (auto &j: jobs) {
+        fprintf(stderr, "%10.3f ms  %s", j.ms, j.program.c_str());
+        if (j.failed) {
+            failed++;
+            fprintf(stderr, "  FAILURE: %s", j.message.c_str());
+            if (j.message.empty() || j.message.back() != '\n') fprintf(stderr, "\n");
+        } else {
+            fprintf(stderr, "\n");
+        }
+    }
+    fprintf(stderr, "programs: %zu, failed: %zu, threads: %u\n", jobs.size(), failed, threads);
+    fprintf(stderr, "wall:     %10.3f ms, %.1f programs/s\n", total_ms,
+            total_ms > 0 ? jobs.size() * 1000.0 / total_ms : 0.0);
+    return failed == 0 ? 0 : 1;
+}
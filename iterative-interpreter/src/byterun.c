@@ -1,25 +1,19 @@
 /* Lama SM Bytecode interpreter */
 
+# define _GNU_SOURCE 1
+
 # include <string.h>
 # include <stdio.h>
 # include <errno.h>
 # include <malloc.h>
-# include "runtime.h"
-
-void *__start_custom_data;
-void *__stop_custom_data;
-
-/* The unpacked representation of bytecode bf */
-typedef struct {
-    char *string_ptr;              /* A pointer to the beginning of the string table */
-    int  *public_ptr;              /* A pointer to the beginning of publics table    */
-    char *code_ptr;                /* A pointer to the bytecode itself               */
-    int  *global_ptr;              /* A pointer to the global area                   */
-    int   stringtab_size;          /* The size (in bytes) of the string table        */
-    int   global_area_size;        /* The size (in words) of global area             */
-    int   public_symbols_number;   /* The number of public symbols                   */
-    char  buffer[0];
-} bytefile;
+# include <stdarg.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/stat.h>
+# include "bytefile.h"
+
+__thread void *__start_custom_data;
+__thread void *__stop_custom_data;
 
 /* Gets a string from a string table by an index */
 char* get_string (bytefile *f, int pos) {
@@ -36,246 +30,338 @@ int get_public_offset (bytefile *f, int i) {
     return f->public_ptr[i*2+1];
 }
 
-/* Reads a binary bytecode bf by name and unpacks it */
+/* Maps a binary bytecode bf by name read-only and unpacks it in place;
+   the bytefile is allocated in a new arena */
 bytefile* read_file (char *fname) {
-    FILE *f = fopen (fname, "rb");
-    long size;
-    bytefile *file;
-
-    if (f == 0) {
+    int         fd = open (fname, O_RDONLY);
+    struct stat st;
+    size_t      size, rest;
+    int        *header;
+    bytefile   *file;
+    arena      *a;
+
+    if (fd == -1) {
         failure ("%s\n", strerror (errno));
     }
 
-    if (fseek (f, 0, SEEK_END) == -1) {
+    if (fstat (fd, &st) == -1) {
         failure ("%s\n", strerror (errno));
     }
 
-    file = (bytefile*) malloc (sizeof(int)*4 + (size = ftell (f)));
+    size = st.st_size;
 
-    if (file == 0) {
-        failure ("*** FAILURE: unable to allocate memory.\n");
+    if (size < 3 * sizeof (int)) {
+        failure ("%s: bytecode file is too short\n", fname);
     }
 
-    rewind (f);
+    header = (int*) mmap (NULL, size, PROT_READ, MAP_PRIVATE | REGION_FLAGS, fd, 0);
 
-    if (size != fread (&file->stringtab_size, 1, size, f)) {
+    if (header == MAP_FAILED) {
         failure ("%s\n", strerror (errno));
     }
 
-    fclose (f);
+    close (fd);
+
+    a    = arena_create ();
+    file = (bytefile*) arena_alloc (a, sizeof (bytefile));
+
+    file->arena_ptr             = a;
+    file->file_ptr              = (char*) header;
+    file->file_size             = size;
+    file->stringtab_size        = header[0];
+    file->global_area_size      = header[1];
+    file->public_symbols_number = header[2];
+
+    rest = size - 3 * sizeof (int);
+
+    if (file->public_symbols_number < 0
+        || file->public_symbols_number > rest / (2 * sizeof (int))) {
+        failure ("%s: invalid number of public symbols %d\n", fname, file->public_symbols_number);
+    }
+
+    rest -= file->public_symbols_number * 2 * sizeof (int);
+
+    if (file->stringtab_size < 0 || file->stringtab_size > rest) {
+        failure ("%s: invalid string table size %d\n", fname, file->stringtab_size);
+    }
+
+    if (file->global_area_size < 0 || file->global_area_size > INT_MAX / sizeof (word)) {
+        failure ("%s: invalid global area size %d\n", fname, file->global_area_size);
+    }
 
-    file->string_ptr  = &file->buffer [file->public_symbols_number * 2 * sizeof(int)];
-    file->public_ptr  = (int*) file->buffer;
+    file->public_ptr  = header + 3;
+    file->string_ptr  = (char*) (file->public_ptr + file->public_symbols_number * 2);
     file->code_ptr    = &file->string_ptr [file->stringtab_size];
-    file->global_ptr  = (int*) malloc (file->global_area_size * sizeof (int));
+
+    if (file->stringtab_size > 0 && file->string_ptr [file->stringtab_size - 1] != 0) {
+        failure ("%s: string table is not terminated\n", fname);
+    }
+
+    /* the arena is mapped like the heap, so that LDA of a global is a value too */
+    file->global_ptr  = (word*) arena_alloc (a, file->global_area_size * sizeof (word));
+    memset (file->global_ptr, 0, file->global_area_size * sizeof (word));
 
     return file;
 }
 
-/* Disassembles the bytecode pool */
-void disassemble (FILE *f, bytefile *bf) {
+/* Moves the mapping of the bytecode bf to address, over whatever is mapped
+   there; returns -1 on failure */
+int move_file (bytefile *f, char *address) {
+    char *p;
+
+    if (f->file_ptr == address) return 0;
+
+    p = mremap (f->file_ptr, f->file_size, f->file_size, MREMAP_MAYMOVE | MREMAP_FIXED, address);
+    if (p == MAP_FAILED) return -1;
+
+    f->public_ptr = (int*) (p + ((char*) f->public_ptr - f->file_ptr));
+    f->string_ptr = p + (f->string_ptr - f->file_ptr);
+    f->code_ptr   = p + (f->code_ptr - f->file_ptr);
+    f->file_ptr   = p;
+    return 0;
+}
+
+/* FNV-1a hash of the whole file of the bytecode bf */
+uint64_t file_hash (bytefile *f) {
+    uint64_t h = 14695981039346656037ull;
+    size_t   i;
+
+    for (i = 0; i < f->file_size; i++) {
+        h = (h ^ (unsigned char) f->file_ptr[i]) * 1099511628211ull;
+    }
+    return h;
+}
+
+/* Unmaps the bytecode bf and frees its global area */
+void close_file (bytefile *f) {
+    munmap (f->file_ptr, f->file_size);
+    __start_custom_data = __stop_custom_data = NULL;
+    arena_release (f->arena_ptr);
+}
+
+/* Prints to f unless f is NULL */
+static void logger (FILE *f, const char *format, ...) {
+    va_list args;
+
+    if (f == NULL) return;
+
+    va_start (args, format);
+    vfprintf (f, format, args);
+    va_end   (args);
+}
+
+/* Disassembles the instruction at ip (only decodes it if f is NULL);
+   returns the next one or NULL at STOP */
+char* disassemble_instruction (FILE *f, bytefile *bf, char *ip) {
 
 # define INT    (ip += sizeof (int), *(int*)(ip - sizeof (int)))
 # define BYTE   *ip++
 # define STRING get_string (bf, INT)
 # define FAIL   failure ("ERROR: invalid opcode %d-%d\n", h, l)
 
-    char *ip     = bf->code_ptr;
     char *ops [] = {"+", "-", "*", "/", "%", "<", "<=", ">", ">=", "==", "!=", "&&", "!!"};
     char *pats[] = {"=str", "#string", "#array", "#sexp", "#ref", "#val", "#fun"};
     char *lds [] = {"LD", "LDA", "ST"};
-    do {
-        char x = BYTE,
-                h = (x & 0xF0) >> 4,
-                l = x & 0x0F;
-
-        fprintf (f, "0x%.8x:\t", ip-bf->code_ptr-1);
-
-        switch (h) {
-            case 15:
-                goto stop;
-
-                /* BINOP */
-            case 0:
-                fprintf (f, "BINOP\t%s", ops[l-1]);
-                break;
-
-            case 1:
-                switch (l) {
-                    case  0:
-                        fprintf (f, "CONST\t%d", INT);
-                        break;
-
-                    case  1:
-                        fprintf (f, "STRING\t%s", STRING);
-                        break;
-
-                    case  2:
-                        fprintf (f, "SEXP\t%s ", STRING);
-                        fprintf (f, "%d", INT);
-                        break;
-
-                    case  3:
-                        fprintf (f, "STI");
-                        break;
-
-                    case  4:
-                        fprintf (f, "STA");
-                        break;
-
-                    case  5:
-                        fprintf (f, "JMP\t0x%.8x", INT);
-                        break;
-
-                    case  6:
-                        fprintf (f, "END");
-                        break;
-
-                    case  7:
-                        fprintf (f, "RET");
-                        break;
-
-                    case  8:
-                        fprintf (f, "DROP");
-                        break;
-
-                    case  9:
-                        fprintf (f, "DUP");
-                        break;
-
-                    case 10:
-                        fprintf (f, "SWAP");
-                        break;
-
-                    case 11:
-                        fprintf (f, "ELEM");
-                        break;
-
-                    default:
-                        FAIL;
-                }
-                break;
-
-            case 2:
-            case 3:
-            case 4:
-                fprintf (f, "%s\t", lds[h-2]);
-                switch (l) {
-                    case 0: fprintf (f, "G(%d)", INT); break;
-                    case 1: fprintf (f, "L(%d)", INT); break;
-                    case 2: fprintf (f, "A(%d)", INT); break;
-                    case 3: fprintf (f, "C(%d)", INT); break;
-                    default: FAIL;
-                }
-                break;
-
-            case 5:
-                switch (l) {
-                    case  0:
-                        fprintf (f, "CJMPz\t0x%.8x", INT);
-                        break;
-
-                    case  1:
-                        fprintf (f, "CJMPnz\t0x%.8x", INT);
-                        break;
-
-                    case  2:
-                        fprintf (f, "BEGIN\t%d ", INT);
-                        fprintf (f, "%d", INT);
-                        break;
-
-                    case  3:
-                        fprintf (f, "CBEGIN\t%d ", INT);
-                        fprintf (f, "%d", INT);
-                        break;
-
-                    case  4:
-                        fprintf (f, "CLOSURE\t0x%.8x", INT);
-                        {int n = INT;
-                            for (int i = 0; i<n; i++) {
-                                switch (BYTE) {
-                                    case 0: fprintf (f, "G(%d)", INT); break;
-                                    case 1: fprintf (f, "L(%d)", INT); break;
-                                    case 2: fprintf (f, "A(%d)", INT); break;
-                                    case 3: fprintf (f, "C(%d)", INT); break;
-                                    default: FAIL;
-                                }
+    char x = BYTE,
+            h = (x & 0xF0) >> 4,
+            l = x & 0x0F;
+
+    switch (h) {
+        case 15:
+            return NULL;
+
+            /* BINOP */
+        case 0:
+            logger (f, "BINOP\t%s", ops[l-1]);
+            break;
+
+        case 1:
+            switch (l) {
+                case  0:
+                    logger (f, "CONST\t%d", INT);
+                    break;
+
+                case  1:
+                    logger (f, "STRING\t%s", STRING);
+                    break;
+
+                case  2:
+                    logger (f, "SEXP\t%s ", STRING);
+                    logger (f, "%d", INT);
+                    break;
+
+                case  3:
+                    logger (f, "STI");
+                    break;
+
+                case  4:
+                    logger (f, "STA");
+                    break;
+
+                case  5:
+                    logger (f, "JMP\t0x%.8x", INT);
+                    break;
+
+                case  6:
+                    logger (f, "END");
+                    break;
+
+                case  7:
+                    logger (f, "RET");
+                    break;
+
+                case  8:
+                    logger (f, "DROP");
+                    break;
+
+                case  9:
+                    logger (f, "DUP");
+                    break;
+
+                case 10:
+                    logger (f, "SWAP");
+                    break;
+
+                case 11:
+                    logger (f, "ELEM");
+                    break;
+
+                default:
+                    FAIL;
+            }
+            break;
+
+        case 2:
+        case 3:
+        case 4:
+            logger (f, "%s\t", lds[h-2]);
+            switch (l) {
+                case 0: logger (f, "G(%d)", INT); break;
+                case 1: logger (f, "L(%d)", INT); break;
+                case 2: logger (f, "A(%d)", INT); break;
+                case 3: logger (f, "C(%d)", INT); break;
+                default: FAIL;
+            }
+            break;
+
+        case 5:
+            switch (l) {
+                case  0:
+                    logger (f, "CJMPz\t0x%.8x", INT);
+                    break;
+
+                case  1:
+                    logger (f, "CJMPnz\t0x%.8x", INT);
+                    break;
+
+                case  2:
+                    logger (f, "BEGIN\t%d ", INT);
+                    logger (f, "%d", INT);
+                    break;
+
+                case  3:
+                    logger (f, "CBEGIN\t%d ", INT);
+                    logger (f, "%d", INT);
+                    break;
+
+                case  4:
+                    logger (f, "CLOSURE\t0x%.8x", INT);
+                    {int n = INT;
+                        for (int i = 0; i<n; i++) {
+                            switch (BYTE) {
+                                case 0: logger (f, "G(%d)", INT); break;
+                                case 1: logger (f, "L(%d)", INT); break;
+                                case 2: logger (f, "A(%d)", INT); break;
+                                case 3: logger (f, "C(%d)", INT); break;
+                                default: FAIL;
                             }
-                        };
-                        break;
-
-                    case  5:
-                        fprintf (f, "CALLC\t%d", INT);
-                        break;
-
-                    case  6:
-                        fprintf (f, "CALL\t0x%.8x ", INT);
-                        fprintf (f, "%d", INT);
-                        break;
-
-                    case  7:
-                        fprintf (f, "TAG\t%s ", STRING);
-                        fprintf (f, "%d", INT);
-                        break;
-
-                    case  8:
-                        fprintf (f, "ARRAY\t%d", INT);
-                        break;
-
-                    case  9:
-                        fprintf (f, "FAIL\t%d", INT);
-                        fprintf (f, "%d", INT);
-                        break;
-
-                    case 10:
-                        fprintf (f, "LINE\t%d", INT);
-                        break;
-
-                    default:
-                        FAIL;
-                }
-                break;
-
-            case 6:
-                fprintf (f, "PATT\t%s", pats[l]);
-                break;
-
-            case 7: {
-                switch (l) {
-                    case 0:
-                        fprintf (f, "CALL\tLread");
-                        break;
-
-                    case 1:
-                        fprintf (f, "CALL\tLwrite");
-                        break;
-
-                    case 2:
-                        fprintf (f, "CALL\tLlength");
-                        break;
-
-                    case 3:
-                        fprintf (f, "CALL\tLstring");
-                        break;
-
-                    case 4:
-                        fprintf (f, "CALL\tBarray\t%d", INT);
-                        break;
-
-                    default:
-                        FAIL;
-                }
+                        }
+                    };
+                    break;
+
+                case  5:
+                    logger (f, "CALLC\t%d", INT);
+                    break;
+
+                case  6:
+                    logger (f, "CALL\t0x%.8x ", INT);
+                    logger (f, "%d", INT);
+                    break;
+
+                case  7:
+                    logger (f, "TAG\t%s ", STRING);
+                    logger (f, "%d", INT);
+                    break;
+
+                case  8:
+                    logger (f, "ARRAY\t%d", INT);
+                    break;
+
+                case  9:
+                    logger (f, "FAIL\t%d", INT);
+                    logger (f, "%d", INT);
+                    break;
+
+                case 10:
+                    logger (f, "LINE\t%d", INT);
+                    break;
+
+                default:
+                    FAIL;
             }
-                break;
+            break;
+
+        case 6:
+            logger (f, "PATT\t%s", pats[l]);
+            break;
+
+        case 7: {
+            switch (l) {
+                case 0:
+                    logger (f, "CALL\tLread");
+                    break;
+
+                case 1:
+                    logger (f, "CALL\tLwrite");
+                    break;
 
-            default:
-                FAIL;
+                case 2:
+                    logger (f, "CALL\tLlength");
+                    break;
+
+                case 3:
+                    logger (f, "CALL\tLstring");
+                    break;
+
+                case 4:
+                    logger (f, "CALL\tBarray\t%d", INT);
+                    break;
+
+                default:
+                    FAIL;
+            }
         }
+            break;
+
+        default:
+            FAIL;
+    }
 
+    return ip;
+}
+
+/* Disassembles the bytecode pool */
+void disassemble (FILE *f, bytefile *bf) {
+    char *ip = bf->code_ptr;
+
+    do {
+        fprintf (f, "0x%.8x:\t", ip-bf->code_ptr);
+        ip = disassemble_instruction (f, bf, ip);
+        if (ip == NULL) break;
         fprintf (f, "\n");
     }
     while (1);
-    stop: fprintf (f, "<end>\n");
+    fprintf (f, "<end>\n");
 }
 
 /* Dumps the contents of the bf */
@@ -0,0 +1,58 @@
+#include "embedding.h"
+#include "iterative_interpreter.h"
+#include "annotations.h"
+#include "register_ir.h"
+
+namespace embedding {
+
+    namespace {
+        // Turns a failure of the runtime into an exception; the runtime frames
+        // it passes through are built with -fexceptions
+        void throw_error(const char *message) {
+            throw error(message);
+        }
+    }
+
+    vm::vm(const char *file_name, const options &opts) {
+        runtime_context *context = runtime_context_create(opts.in, opts.out, !opts.trusted, throw_error);
+        try {
+            {
+                // loading runs in the context of the vm too, so that its failures throw
+                context_scope scope(context);
+                bf = read_file(const_cast<char *>(file_name));
+                stacks = verifier::verify(bf);
+                if (opts.annotations != nullptr) {
+                    notes = new annotations(bf, opts.annotations);
+                }
+                if (opts.registers) {
+                    program = new register_ir::program(bf, stacks, notes);
+                }
+            }
+            interpreter = new iterative_interpreter(bf, stacks, nullptr, notes, program, context);
+        } catch (...) {
+            delete program;
+            delete notes;
+            if (bf != nullptr) {
+                close_file(bf);
+            }
+            runtime_context_destroy(context);
+            throw;
+        }
+    }
+
+    // The interpreter goes last, it releases the arena the others allocate in
+    vm::~vm() {
+        delete program;
+        delete notes;
+        delete interpreter;
+    }
+
+    word vm::run() {
+        if (finished) {
+            throw error("the program has already been run");
+        }
+        finished = true;
+        word result = interpreter->eval();
+        return boxing::is_boxed(result) ? boxing::unbox(result) : 0;
+    }
+}
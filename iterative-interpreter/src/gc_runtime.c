@@ -0,0 +1,37 @@
+/* Stack roots of the collector: a portable replacement of the Lama gc_runtime.s */
+
+# include "runtime.h"
+
+/* The operand stack of the interpreter, [__gc_stack_top, __gc_stack_bottom);
+   the interpreter keeps __gc_stack_top up to date at every allocation. Every
+   thread has the stack of the machine it runs */
+__thread size_t __gc_stack_top, __gc_stack_bottom;
+
+extern void __init (void);
+extern void gc_test_and_copy_slot (word *slot);
+
+void __gc_init (void) {
+    __init ();
+}
+
+/* The compiled Lama code marks the stack top around a call into the runtime;
+   with the interpreter the top is always known, so there is nothing to do */
+void __pre_gc (void) {}
+
+void __post_gc (void) {}
+
+/* Copies the heap objects referenced from the stack; boxed integers (odd
+   words) and pointers into the stack itself are skipped, everything else is
+   left to gc_test_and_copy_slot, which ignores words outside of the heap */
+void __gc_root_scan_stack (void) {
+    word *p;
+
+    for (p = (word*) __gc_stack_top; p < (word*) __gc_stack_bottom; p++) {
+        size_t v = (size_t) DECOMPRESS(*p);
+
+        if (v & 1) continue;
+        if (__gc_stack_top <= v && v <= __gc_stack_bottom) continue;
+
+        gc_test_and_copy_slot (p);
+    }
+}
@@ -1,32 +1,38 @@
 //#define DEBUG_PRINT 1
 
 #include "iterative_interpreter.h"
+#include "opcodes.h"
+#include "profiler.h"
+#include "annotations.h"
+#include "register_ir.h"
+#include "snapshot.h"
+#include <algorithm>
+#include <cstring>
 #include <exception>
+#include <functional>
 #include <stdexcept>
 
 extern "C" {
+#include "runtime_common.h"
 extern void __init(void);
+extern void __shutdown(void);
 extern void *Bstring(void *);
-extern void *Bsexp_arr(int bn, int tag, int *values);
-extern int LtagHash(char *s);
-extern void *Bsta(void *v, int i, void *x);
-extern void *Belem(void *p, int i);
-extern void* Belem_closure (void *p, int i);
-extern int Btag(void *d, int t, int n);
-extern int Barray_patt(void *d, int n);
-extern int Bstring_patt(void *x, void *y);
-extern int Bstring_tag_patt(void *x);
-extern int Barray_tag_patt(void *x);
-extern int Bsexp_tag_patt(void *x);
-extern int Bboxed_patt(void *x);
-extern int Bunboxed_patt(void *x);
-extern int Bclosure_tag_patt(void *x);
-extern int Lread();
-extern int Lwrite(int);
-extern int Llength(void *);
+extern void *Bsexp_arr(word bn, word tag, word *values);
+extern void *Bcons(word *top);
+extern word Bsexp_header(word t, word n);
+extern word LtagHash(char *s);
+extern void *Bsta(void *v, word i, void *x);
+extern void *Belem(void *p, word i);
+extern word Btag(void *d, word t, word n);
+extern int Bshape(void *d, int *tag, int *n);
+extern word Barray_patt(void *d, word n);
+extern word Bstring_patt(void *x, void *y);
+extern word Lread();
+extern word Lwrite(word);
+extern word Llength(void *);
 extern void *Lstring(void *p);
-extern void *Barray_arr(int bn, int *values);
-extern void *Bclosure_arr(int bn, void *entry, int *values);
+extern void *Barray_arr(word bn, word *values);
+extern void *Bclosure_entry(word bn, void *entry);
 }
 
 # define INT    (ip += sizeof (int), *(int*)(ip - sizeof (int)))
@@ -34,109 +40,175 @@ extern void *Bclosure_arr(int bn, void *entry, int *values);
 # define STRING get_string (this->bf, INT)
 # define FAIL   failure ("ERROR: invalid opcode %d-%d\n", h, l)
 
-#define STOP           0xF
-#define BINOP          0x0
-#define BINOP_ADD      0x01
-#define BINOP_SUB      0x02
-#define BINOP_PROD     0x03
-#define BINOP_DIV      0x04
-#define BINOP_MOD      0x05
-#define BINOP_LESS     0x06
-#define BINOP_ELESS    0x07
-#define BINOP_GREATER  0x08
-#define BINOP_EGREATER 0x09
-#define BINOP_EQUAL    0x0A
-#define BINOP_NEQUAL   0x0B
-#define BINOP_AND      0x0C
-#define BINOP_OR       0x0D
-#define BLOCK_DATE     0x1
-#define BLOCK_CONST    0x10
-#define BLOCK_STRING   0x11
-#define BLOCK_SEXP     0x12
-#define BLOCK_STI      0x13
-#define BLOCK_STA      0x14
-#define BLOCK_JMP      0x15
-#define BLOCK_END      0x16
-#define BLOCK_RET      0x17
-#define BLOCK_DROP     0x18
-#define BLOCK_DUP      0x19
-#define BLOCK_SWAP     0x1A
-#define BLOCK_ELEM     0x1B
-#define LD             0x2
-#define LDA            0x3
-#define ST             0x4
-#define BLOCK_MOVE     0x5
-#define CJMPZ          0x50
-#define CJMPNZ         0x51
-#define BEGIN          0x52
-#define CBEGIN         0x53
-#define CLOSUSRE       0x54
-#define CALLC          0x55
-#define CALL           0x56
-#define PLACE_TAG      0x57
-#define ARRAY          0x58
-#define CALL_FAIL      0x59
-#define LINE           0x5A
-#define PATT           0x6
-#define PATT_BSTRING   0x60
-#define PATT_BSTRING_T 0x61
-#define PATT_BARRAY_T  0x62
-#define PATT_BSEXP_T   0x63
-#define PATT_BBOXED    0x64
-#define PATT_BUNBOXED  0x65
-#define PATT_BCLOSURE_T 0x66
-#define BLOCK_CALL     0x7
-#define CALL_LREAD     0x70
-#define CALL_LWRITE    0x71
-#define CALL_LLENGTH   0x72
-#define CALL_LSRTING   0x73
-#define CALL_BARRAY    0x74
-
-#define MAX_CLOSURE_ARGC 32
-
 using namespace boxing;
 
-iterative_interpreter::iterative_interpreter(bytefile *file) : bf(file), ip(bf->code_ptr) {
+iterative_interpreter::iterative_interpreter(bytefile *file, const verifier::stack_map &stacks, profiler *prof,
+                                             annotations *notes, register_ir::program *registers,
+                                             runtime_context *context)
+        : context(context != nullptr ? context : runtime_context_create(stdin, stdout, 1, nullptr)),
+          bf(file), ip(bf->code_ptr), prof(prof), notes(notes), registers(registers),
+          tail_calls(arena_allocator<bool>(bf->arena_ptr)), functions(arena_allocator<function_info>(bf->arena_ptr)),
+          decisions(arena_allocator<decision_table>(bf->arena_ptr)), decision_at(arena_allocator<int32_t>(bf->arena_ptr)),
+          sexps(arena_allocator<sexp_info>(bf->arena_ptr)), sexp_at(arena_allocator<int32_t>(bf->arena_ptr)) {
+    context_scope scope(this->context);
+    int32_t code_size = bf->file_ptr + bf->file_size - bf->code_ptr;
+    tail_calls.assign(code_size, false);
+    functions.assign(code_size, {0, 0});
+    decision_at.assign(code_size, -1);
+    sexp_at.assign(code_size, -1);
+    int32_t function = 0;
+    for (int32_t offset = 0; offset < code_size; offset++) {
+        if (!stacks.reachable(offset)) continue;
+        char x = bf->code_ptr[offset];
+        if (x == BEGIN || x == CBEGIN) {
+            function = offset;
+            functions[offset].nlocals = *reinterpret_cast<int32_t *>(bf->code_ptr + offset + 1 + sizeof(int32_t));
+        }
+        functions[function].depth = std::max(functions[function].depth, (int32_t) stacks.before(offset).size());
+        if (stacks.tail_call(offset)) {
+            tail_calls[offset + (x == CALL ? 9 : 5)] = true;
+        }
+        // profiles keep showing the tests as they are in the bytecode
+        if (x == BLOCK_DUP && prof == nullptr) {
+            find_decisions(offset);
+        }
+        if (x == BLOCK_SEXP || x == PLACE_TAG) {
+            resolve_sexp(offset);
+        }
+    }
+
     __init();
     stack::init();
+    __start_custom_data = bf->global_ptr;
+    __stop_custom_data = bf->global_ptr + bf->global_area_size;
 
     fp = stack::get_stack_top();
     stack::reserve(2);
-    stack::push(reinterpret_cast<int32_t>(nullptr));
+    stack::push(compress(nullptr));
     stack::push(2);
 }
 
+// The tables go away with the arena; the decision tables are destroyed while
+// it is still there, the other ones hold plain values
 iterative_interpreter::~iterative_interpreter() {
-    free(bf->global_ptr);
-    free(bf);
-    stack::clear();
+    decisions.clear();
+    {
+        context_scope scope(context);
+        close_file(bf);
+        stack::clear();
+        __shutdown();
+    }
+    runtime_context_destroy(context);
 }
 
-int32_t *iterative_interpreter::global(int32_t i) {
+word *iterative_interpreter::global(int32_t i) {
     return bf->global_ptr + i;
 }
 
-int32_t *iterative_interpreter::local(int32_t i) {
+// Moves the top words (the reversed arguments of a tail call and, for CALLC,
+// the closure) over the current frame and pushes its return address, so the
+// callee returns straight to the caller of the current function
+void iterative_interpreter::reuse_frame(int32_t words) {
+    word *bottom = args(fp[1]);
+    word ret = fp[2];
+    fp = decompress<word>(fp[0]);
+    std::memmove(bottom - words, stack::get_stack_top(), words * sizeof(word));
+    stack::set_stack_top(bottom - words);
+    stack::push(ret);
+}
+
+// Sets up the frame of the function at addr like its BEGIN would, from the
+// cached operands, and continues right after the BEGIN
+inline void iterative_interpreter::enter(int32_t addr) {
+    const function_info &f = functions[addr];
+    stack::push(compress(fp));
+    fp = stack::get_stack_top();
+    stack::reserve(f.nlocals, f.depth);
+    ip = bf->code_ptr + addr + 1 + 2 * sizeof(int32_t);
+}
+
+static uint32_t shape_hash(int32_t kind, int32_t tag, int32_t arity) {
+    uint32_t h = (uint32_t) tag * 31 + (uint32_t) arity * 7 + (uint32_t) kind;
+    h ^= h >> 16;
+    h *= 0x45d9f3b;
+    h ^= h >> 16;
+    return h;
+}
+
+// Builds a decision table for the chain of tests starting at offset, if there
+// are at least two of them. The first test of a shape wins, as in the chain.
+void iterative_interpreter::find_decisions(int32_t offset) {
+    std::vector<decision_table::arm> arms;
+    int32_t at = offset;
+    auto read = [this](int32_t pos) { return *reinterpret_cast<int32_t *>(bf->code_ptr + pos); };
+    while (bf->code_ptr[at] == BLOCK_DUP) {
+        decision_table::arm arm{};
+        int32_t test = at + 1, next;
+        if (bf->code_ptr[test] == PLACE_TAG) {
+            arm = {SEXP_TAG, (int32_t) unbox(LtagHash(get_string(bf, read(test + 1)))), read(test + 5), 0};
+            next = test + 9;
+        } else if (bf->code_ptr[test] == ARRAY) {
+            arm = {ARRAY_TAG, 0, read(test + 1), 0};
+            next = test + 5;
+        } else {
+            break;
+        }
+        if (bf->code_ptr[next] != CJMPZ || read(next + 1) <= at) break;
+        arm.target = next + 5;
+        bool shadowed = false;
+        for (auto &a: arms) {
+            shadowed |= a.kind == arm.kind && a.tag == arm.tag && a.arity == arm.arity;
+        }
+        if (!shadowed) {
+            arms.push_back(arm);
+        }
+        at = read(next + 1);
+    }
+    if (arms.size() < 2) return;
+
+    for (uint32_t size = 4; size <= 64 * arms.size(); size *= 2) {
+        decision_table table{arena_vector<decision_table::arm>(size, {0, 0, 0, 0}, arena_allocator<decision_table::arm>(bf->arena_ptr)),
+                             size - 1, at};
+        bool collision = false;
+        for (auto &a: arms) {
+            auto &slot = table.slots[shape_hash(a.kind, a.tag, a.arity) & table.mask];
+            collision |= slot.kind != 0;
+            slot = a;
+        }
+        if (!collision) {
+            decision_at[offset] = decisions.size();
+            decisions.push_back(std::move(table));
+            return;
+        }
+    }
+}
+
+// Hashes the tag of the SEXP or TAG at offset once instead of at every execution
+void iterative_interpreter::resolve_sexp(int32_t offset) {
+    auto read = [this](int32_t pos) { return *reinterpret_cast<int32_t *>(bf->code_ptr + pos); };
+    word tag = LtagHash(get_string(bf, read(offset + 1)));
+    int32_t n = read(offset + 5);
+    sexp_at[offset] = sexps.size();
+    sexps.push_back({tag, Bsexp_header(tag, box(n)), n, tag == LtagHash((char *) "cons") && n == 2});
+}
+
+word *iterative_interpreter::local(int32_t i) {
     return fp - i - 1;
 }
 
-int32_t *iterative_interpreter::args(int32_t i) {
+word *iterative_interpreter::args(int32_t i) {
     return fp + i + 3;
 }
 
-int32_t *iterative_interpreter::binded(int32_t i) {
+// The closure is the last word of the frame of a CALLC; its contents start
+// with the entry, followed by the captured values
+word *iterative_interpreter::binded(int32_t i) {
     int32_t nargs = *(fp + 1);
-    auto id = reinterpret_cast<int32_t *>(*args(nargs - 1));
-    auto result = reinterpret_cast<int32_t>(Belem_closure(id, box(i + 1)));
-
-    return reinterpret_cast<int32_t *>(result);
+    auto closure = decompress<word>(*args(nargs - 1));
+    return closure + i + 1;
 }
 
-int32_t *iterative_interpreter::lookup(char l, int32_t i) {
-#define GLOBAL 0
-#define LOCAL 1
-#define ARGS 2
-#define BINDED 3
+word *iterative_interpreter::lookup(char l, int32_t i) {
     switch (l) {
         case GLOBAL:
             return global(i);
@@ -153,59 +225,111 @@ int32_t *iterative_interpreter::lookup(char l, int32_t i) {
     return nullptr;
 }
 
+// BINOP sites the static analyzer proved to get integers
+bool iterative_interpreter::integer_operands() {
+    return notes != nullptr && notes->integer_operands(ip - 1 - bf->code_ptr);
+}
+
 void iterative_interpreter::jmp(int32_t addr) {
     ip = bf->code_ptr + addr;
 }
 
 
-void iterative_interpreter::eval_binop(char op) {
-    int32_t y = stack::unbox_pop();
-    int32_t x = stack::unbox_pop();
-    int32_t res;
+// Arithmetic on unboxed operands; comparisons also give the right answer on
+// tagged ones, since boxing is monotone
+static word apply_binop(char op, word x, word y) {
     switch (op) {
         case BINOP_ADD:
-            res = x + y;
-            break;
+            return x + y;
         case BINOP_SUB:
-            res = x - y;
-            break;
+            return x - y;
         case BINOP_PROD:
-            res = x * y;
-            break;
+            return x * y;
         case BINOP_DIV:
-            res = x / y;
-            break;
+            return x / y;
         case BINOP_MOD:
-            res = x % y;
-            break;
+            return x % y;
         case BINOP_LESS:
-            res = x < y;
-            break;
+            return x < y;
         case BINOP_ELESS:
-            res = x <= y;
-            break;
+            return x <= y;
         case BINOP_GREATER:
-            res = x > y;
-            break;
+            return x > y;
         case BINOP_EGREATER:
-            res = x >= y;
-            break;
+            return x >= y;
         case BINOP_EQUAL:
-            res = x == y;
-            break;
+            return x == y;
         case BINOP_NEQUAL:
-            res = x != y;
-            break;
+            return x != y;
         case BINOP_AND:
-            res = x && y;
-            break;
+            return x && y;
         case BINOP_OR:
-            res = x || y;
-            break;
+            return x || y;
         default:
             failure("ERROR: invalid opcode %d\n", op);
     }
-    stack::push_box(res);
+    return 0;
+}
+
+void iterative_interpreter::eval_binop(char op) {
+    word y = stack::unbox_pop();
+    word x = stack::unbox_pop();
+    stack::push_box(apply_binop(op, x, y));
+}
+
+// With integer operands the handlers below work on the tagged representation,
+// box(x) = 2x + 1, without unboxing the operands and boxing the result; on
+// references that would make up a pointer, so sites not proven to get integers
+// unbox, and the result is an integer whatever the operands are
+template<bool integers>
+inline void iterative_interpreter::eval_add() {
+    word y = stack::pop();
+    if (integers) {
+        stack::top() += y - 1;
+    } else {
+        stack::top() = box(unbox(stack::top()) + unbox(y));
+    }
+}
+
+template<bool integers>
+inline void iterative_interpreter::eval_sub() {
+    word y = stack::pop();
+    if (integers) {
+        stack::top() -= y - 1;
+    } else {
+        stack::top() = box(unbox(stack::top()) - unbox(y));
+    }
+}
+
+template<bool integers>
+inline void iterative_interpreter::eval_mul() {
+    word y = unbox(stack::pop());
+    if (integers) {
+        stack::top() = (stack::top() - 1) * y + 1;
+    } else {
+        stack::top() = box(unbox(stack::top()) * y);
+    }
+}
+
+// Boxing is monotone, so tagged values compare as the integers do, and any
+// two values compare to a boolean, so no site needs a proof. A compare
+// directly followed by CJMPz/CJMPnz takes the branch itself and never pushes
+// the boolean; the profiler sees the two instructions separately, so it runs
+// without fusion.
+template<bool fuse, typename compare>
+inline void iterative_interpreter::eval_compare() {
+    word y = stack::pop();
+    word x = stack::pop();
+    bool result = compare()(x, y);
+    if (fuse && (*ip == CJMPZ || *ip == CJMPNZ)) {
+        bool jump_if = *ip++ == CJMPNZ;
+        int32_t addr = INT;
+        if (result == jump_if) {
+            jmp(addr);
+        }
+        return;
+    }
+    stack::push_box(result);
 }
 
 inline void iterative_interpreter::eval_const(int value) {
@@ -213,40 +337,45 @@ inline void iterative_interpreter::eval_const(int value) {
 }
 
 inline void iterative_interpreter::eval_string(char *str) {
-    stack::push(reinterpret_cast<int32_t>(Bstring(str)));
+    stack::push(compress(Bstring(str)));
 }
 
-inline void iterative_interpreter::eval_sexp(char *name, int n) {
-    int32_t tag = LtagHash(name);
-    stack::reverse(n);
-    auto res = reinterpret_cast<int32_t>(Bsexp_arr(box(n + 1), tag, stack::get_stack_top()));
-    stack::drop(n);
+inline void iterative_interpreter::eval_sexp(const sexp_info &sexp) {
+    if (sexp.cons) {
+        auto res = compress(Bcons(stack::get_stack_top()));
+        stack::drop(1);
+        stack::top() = res;
+        return;
+    }
+    stack::reverse(sexp.n);
+    auto res = compress(Bsexp_arr(box(sexp.n + 1), sexp.tag, stack::get_stack_top()));
+    stack::drop(sexp.n);
     stack::push(res);
 }
 
 inline void iterative_interpreter::eval_sta() {
-    void *v = reinterpret_cast<void *>(stack::pop());
-    int32_t i = stack::pop();
+    void *v = decompress(stack::pop());
+    word i = stack::pop();
 
     if (!is_boxed(i)) {
-        return stack::push(reinterpret_cast<int32_t>(Bsta(v, i, nullptr)));
+        return stack::push(compress(Bsta(v, i, nullptr)));
     }
-    void *x = reinterpret_cast<void *>(stack::pop());
-    stack::push(reinterpret_cast<int32_t>(Bsta(v, i, x)));
+    void *x = decompress(stack::pop());
+    stack::push(compress(Bsta(v, i, x)));
 }
 
 inline void iterative_interpreter::eval_jmp(int32_t offset) {
     ip = bf->code_ptr + offset;
 }
 
+// The result takes the place of the last word of the frame
 inline void iterative_interpreter::eval_end() {
-    int32_t result = stack::pop();
-    stack::set_stack_top(fp);
-    fp = reinterpret_cast<int32_t *>(stack::pop());
-    int32_t argc = stack::pop();
-    ip = reinterpret_cast<char *>(stack::pop());
-    stack::drop(argc);
-    stack::push(result);
+    word result = stack::peek();
+    word *frame = fp;
+    fp = decompress<word>(frame[0]);
+    ip = decompress<char>(frame[2]);
+    stack::set_stack_top(frame + frame[1] + 2);
+    stack::top() = result;
 }
 
 inline void iterative_interpreter::eval_drop() {
@@ -257,33 +386,77 @@ inline void iterative_interpreter::eval_dup() {
     stack::push(stack::peek());
 }
 
+// Stands for the whole chain: the value stays on the stack, and control goes
+// to the code after the first test it passes or past the last test
+inline void iterative_interpreter::eval_match(const decision_table &table) {
+    int32_t tag, arity;
+    int32_t kind = Bshape(decompress(stack::peek()), &tag, &arity);
+    auto &slot = table.slots[shape_hash(kind, tag, arity) & table.mask];
+    bool matched = slot.kind == kind && slot.tag == tag && slot.arity == arity;
+    jmp(matched ? slot.target : table.otherwise);
+}
+
 inline void iterative_interpreter::eval_swap() {
-    int32_t v1 = stack::pop();
-    int32_t v2 = stack::pop();
+    word v1 = stack::pop();
+    word v2 = stack::pop();
 
     stack::push(v1);
     stack::push(v2);
 }
 
+// Pattern tests on a value: the tag bit tells integers from references, and
+// the kind of a reference is in the header word in front of its contents
+// (see TO_DATA in runtime.c)
+namespace {
+    inline int32_t kind_of(word value) {
+        return decompress<word>(value)[-1] & 0x7;
+    }
+
+    template<int32_t kind>
+    struct has_kind {
+        bool operator()(word value) const {
+            return !is_boxed(value) && kind_of(value) == kind;
+        }
+    };
+
+    struct is_reference {
+        bool operator()(word value) const {
+            return !is_boxed(value);
+        }
+    };
+
+    struct is_integer {
+        bool operator()(word value) const {
+            return is_boxed(value);
+        }
+    };
+}
+
+// Fields of sexps, arrays and closures are read in place, only strings (and
+// operands that fail the checks of Belem) go to the runtime
 inline void iterative_interpreter::eval_elem() {
-    int32_t i = stack::pop();
-    void *p = reinterpret_cast<void *>(stack::pop());
-    stack::push(reinterpret_cast<int32_t>(Belem(p, i)));
+    word i = stack::pop();
+    word p = stack::top();
+    if (is_boxed(i) && !is_boxed(p) && kind_of(p) != STRING_TAG) {
+        stack::top() = decompress<word>(p)[unbox(i)];
+        return;
+    }
+    stack::top() = compress(Belem(decompress(p), i));
 }
 
 inline void iterative_interpreter::eval_ld(int32_t l, int32_t i) {
-    int32_t value = *lookup(l, i);
+    word value = *lookup(l, i);
     stack::push(value);
 }
 
 inline void iterative_interpreter::eval_lda(int32_t l, int32_t i) {
-    int32_t *ptr = lookup(l, i);
-    stack::push(reinterpret_cast<int32_t>(ptr));
+    word *ptr = lookup(l, i);
+    stack::push(compress(ptr));
 }
 
 inline void iterative_interpreter::eval_st(int32_t l, int32_t i) {
-    int32_t *ptr = lookup(l, i);
-    int32_t value = stack::peek();
+    word *ptr = lookup(l, i);
+    word value = stack::peek();
     *ptr = value;
 }
 
@@ -300,56 +473,68 @@ inline void iterative_interpreter::eval_cjmpnz(int32_t addr) {
 }
 
 inline void iterative_interpreter::eval_begin(int32_t argc, int32_t nlocals) {
-    stack::push(reinterpret_cast<int32_t>(fp));
+    stack::push(compress(fp));
     fp = stack::get_stack_top();
     stack::reserve(nlocals);
 }
 
+// The captures are read after the allocation, which may move the objects they
+// refer to; until then they stay in variables the collector knows about
 inline void iterative_interpreter::eval_closure(int32_t addr, int32_t argc) {
-    if (argc > MAX_CLOSURE_ARGC) {
-        failure("Too much argc for closure");
-    }
-    //FIX remove array
-    int32_t args[MAX_CLOSURE_ARGC];
+    auto closure = reinterpret_cast<word *>(Bclosure_entry(box(argc), bf->code_ptr + addr));
     for (int i = 0; i < argc; i++) {
         char l = BYTE;
-        int value = INT;
-        args[i] = *lookup(l, value);
-        //stack::push(*lookup(l, value));
+        int32_t value = INT;
+        closure[i + 1] = *lookup(l, value);
     }
-
-    void *result = Bclosure_arr(box(argc), bf->code_ptr + addr, args); //stack::get_stack_top()
-
-    //stack::drop(argc);
-
-    stack::push(reinterpret_cast<int32_t>(result));
+    stack::push(compress(closure));
 }
 
 inline void iterative_interpreter::eval_callc(int32_t argc) {
-    void *label = Belem(reinterpret_cast<int32_t *>(stack::peek(argc)), box(0));
+    void *label = Belem(decompress<word>(stack::peek(argc)), box(0));
     stack::reverse(argc);
-    stack::push(reinterpret_cast<int32_t>(ip));
+    if (tail_calls[ip - bf->code_ptr]) {
+        reuse_frame(argc + 1);
+    } else {
+        stack::push(compress(ip));
+    }
     stack::push(argc + 1);
-    ip = reinterpret_cast<char *>(label);
+    enter(reinterpret_cast<char *>(label) - bf->code_ptr);
 }
 
 inline void iterative_interpreter::eval_call(int32_t addr, int32_t argc) {
     //fprintf(stdout, "eval_call addr=%d, argc=%d\n", addr, argc);
     stack::reverse(argc);
-    stack::push(reinterpret_cast<int32_t>(ip));
+    if (tail_calls[ip - bf->code_ptr]) {
+        reuse_frame(argc);
+    } else {
+        stack::push(compress(ip));
+    }
     stack::push(argc);
-    jmp(addr);
+    enter(addr);
 }
 
-inline void iterative_interpreter::eval_tag(char *name, int32_t n) {
-    void *d = reinterpret_cast<void *>(stack::pop());
-    int32_t t = LtagHash(name);
-    stack::push(Btag(d, t, box(n)));
+// A packed shape is recognized by the header alone, without a call into the
+// runtime; fuses with a following CJMPz/CJMPnz like eval_compare
+template<bool fuse>
+inline void iterative_interpreter::eval_tag(const sexp_info &sexp) {
+    word value = stack::pop();
+    bool result = sexp.header != 0 ? !is_boxed(value) && decompress<word>(value)[-1] == sexp.header
+                                   : unbox(Btag(decompress(value), sexp.tag, box(sexp.n))) != 0;
+    if (fuse && (*ip == CJMPZ || *ip == CJMPNZ)) {
+        bool jump_if = *ip++ == CJMPNZ;
+        int32_t addr = INT;
+        if (result == jump_if) {
+            jmp(addr);
+        }
+        return;
+    }
+    stack::push_box(result);
 }
 
 inline void iterative_interpreter::eval_array(int32_t n) {
-    void *d = reinterpret_cast<void *>(stack::pop());
-    int32_t res = Barray_patt(d, box(n));
+    void *d = decompress(stack::pop());
+    word res = Barray_patt(d, box(n));
     stack::push(res);
 }
 
@@ -361,231 +546,491 @@ inline void iterative_interpreter::eval_line(int32_t _) {
     //nothing
 }
 
-void iterative_interpreter::eval_patt(char ch) {
-    char h = 0xF0 & ch, l = 0x0F & ch;
-    auto value = reinterpret_cast<int32_t *>(stack::pop());
-    int32_t result = 0;
-    switch (ch) {
-        case PATT_BSTRING:
-            result = Bstring_patt(value, reinterpret_cast<int32_t *>(stack::pop()));
-            break;
-        case PATT_BSTRING_T:
-            result = Bstring_tag_patt(value);
-            break;
-        case PATT_BARRAY_T:
-            result = Barray_tag_patt(value);
-            break;
-        case PATT_BBOXED:
-            result = Bsexp_tag_patt(value);
-            break;
-        case PATT_BSEXP_T:
-            result = Bboxed_patt(value);
-            break;
-        case PATT_BUNBOXED:
-            result = Bunboxed_patt(value);
-            break;
-        case PATT_BCLOSURE_T:
-            result = Bclosure_tag_patt(value);
-            break;
-        default:
-            FAIL;
+// Fuses with a following CJMPz/CJMPnz like eval_compare
+template<bool fuse, typename test>
+inline void iterative_interpreter::eval_patt() {
+    bool result = test()(stack::pop());
+    if (fuse && (*ip == CJMPZ || *ip == CJMPNZ)) {
+        bool jump_if = *ip++ == CJMPNZ;
+        int32_t addr = INT;
+        if (result == jump_if) {
+            jmp(addr);
+        }
+        return;
     }
-    stack::push(result);
+    stack::push_box(result);
+}
+
+// The string pattern is on top, the value below it
+inline void iterative_interpreter::eval_patt_string() {
+    auto pattern = decompress<word>(stack::pop());
+    auto value = decompress<word>(stack::pop());
+    stack::push(Bstring_patt(value, pattern));
 }
 
 inline void iterative_interpreter::eval_call_lread() {
-    int32_t value = Lread();
+    word value = Lread();
     stack::push(value);
 }
 
 inline void iterative_interpreter::eval_call_lwrite() {
-    int32_t value = stack::pop();
+    word value = stack::pop();
     stack::push(Lwrite(value));
 }
 
 inline void iterative_interpreter::eval_call_llength() {
-    stack::push(Llength(reinterpret_cast<void *>(stack::pop())));
+    stack::push(Llength(decompress(stack::pop())));
 }
 
 inline void iterative_interpreter::eval_call_lstring() {
-    void *str = Lstring(reinterpret_cast<void *>(stack::pop()));
-    stack::push(reinterpret_cast<int32_t>(str));
+    void *str = Lstring(decompress(stack::pop()));
+    stack::push(compress(str));
 }
 
 inline void iterative_interpreter::eval_call_barray(int32_t n) {
     //fprintf(stdout, "eval_call_barray n=%d\n", n);
     stack::reverse(n);
-    auto result = reinterpret_cast<int32_t>(Barray_arr(box(n), stack::get_stack_top()));
+    auto result = compress(Barray_arr(box(n), stack::get_stack_top()));
     stack::drop(n);
     stack::push(result);
 }
 
-void iterative_interpreter::eval() {
+// A guard hit of the operand stack comes back here and is reported as a failure
+// outside of the signal handler. The jump skips the frames of the run, which
+// hold nothing to destroy
+word iterative_interpreter::eval() {
+    context_scope scope(context);
+    sigjmp_buf point;
+    stack::guard_scope guard(point);
+    if (int fault = sigsetjmp(point, 1)) {
+        stack::guard_failure(fault);
+    }
+    if (registers != nullptr) {
+        run_registers();
+    } else if (prof != nullptr) {
+        run<true>();
+    } else if (snapshot_ip == nullptr || run_to_snapshot()) {
+        run<false>();
+    }
+    return stack::peek();
+}
+
+void iterative_interpreter::snapshot_at(int32_t offset, const char *name) {
+    snapshot_ip = bf->code_ptr + offset;
+    snapshot_name = name;
+}
+
+void iterative_interpreter::restore(const char *name, const snapshot::reservation &ranges) {
+    context_scope scope(context);
+    auto at = snapshot::read(name, ranges, bf);
+    ip = at.ip;
+    fp = at.fp;
+}
+
+// Instructions are not fused on the way, so that the program stops at any of them
+bool iterative_interpreter::run_to_snapshot() {
+    while (ip != snapshot_ip) {
+        if (ip == nullptr || !step<false>()) {
+            fprintf(stderr, "the program ended before 0x%.8x, no snapshot is written\n",
+                    (unsigned) (snapshot_ip - bf->code_ptr));
+            return false;
+        }
+    }
+    snapshot::write(snapshot_name, bf, {ip, fp});
+    return true;
+}
+
+template<bool profile>
+void iterative_interpreter::run() {
     do {
-        char x = BYTE,
-                h = (x & 0xF0) >> 4,
-                l = x & 0x0F;
+        if (profile) {
+            prof->enter(ip);
+        }
+        if (!step<!profile>()) {
+            return;
+        }
+        if (profile) {
+            prof->leave();
+        }
+    } while (ip != nullptr);
+}
+
+template<bool fuse>
+bool iterative_interpreter::step() {
+    char x = BYTE,
+            h = (x & 0xF0) >> 4,
+            l = x & 0x0F;
 #ifdef DEBUG_PRINT
-        fprintf(stdout, "h = %d | l = %d\n", h, l);
+    fprintf(stdout, "h = %d | l = %d\n", h, l);
 #endif
-        int arg1 = 0;
-        char *str = nullptr;
-        switch (h) {
-            case STOP:
-                return;
+    int arg1 = 0;
+    switch (h) {
+        case STOP:
+            return false;
+
+            /* BINOP */
+        case BINOP:
+            switch (x) {
+                case BINOP_ADD:
+                    if (integer_operands()) {
+                        eval_add<true>();
+                    } else {
+                        eval_add<false>();
+                    }
+                    break;
+                case BINOP_SUB:
+                    if (integer_operands()) {
+                        eval_sub<true>();
+                    } else {
+                        eval_sub<false>();
+                    }
+                    break;
+                case BINOP_PROD:
+                    if (integer_operands()) {
+                        eval_mul<true>();
+                    } else {
+                        eval_mul<false>();
+                    }
+                    break;
+                case BINOP_LESS:
+                    eval_compare<fuse, std::less<word>>();
+                    break;
+                case BINOP_ELESS:
+                    eval_compare<fuse, std::less_equal<word>>();
+                    break;
+                case BINOP_GREATER:
+                    eval_compare<fuse, std::greater<word>>();
+                    break;
+                case BINOP_EGREATER:
+                    eval_compare<fuse, std::greater_equal<word>>();
+                    break;
+                case BINOP_EQUAL:
+                    eval_compare<fuse, std::equal_to<word>>();
+                    break;
+                case BINOP_NEQUAL:
+                    eval_compare<fuse, std::not_equal_to<word>>();
+                    break;
+                default:
+                    eval_binop(x);
+            }
+            break;
 
-                /* BINOP */
-            case BINOP:
-                eval_binop(x);
-                break;
+        case BLOCK_DATE:
+            switch (x) {
+                case BLOCK_CONST:
+                    eval_const(INT);
+                    break;
+
+                case BLOCK_STRING:
+                    eval_string(STRING);
+                    break;
+
+                case BLOCK_SEXP:
+                    eval_sexp(sexps[sexp_at[ip - 1 - bf->code_ptr]]);
+                    ip += 2 * sizeof(int32_t);
+                    break;
+
+                case BLOCK_STA:
+                    eval_sta();
+                    break;
+
+                case BLOCK_JMP:
+                    eval_jmp(INT);
+                    break;
+
+                case BLOCK_END:
+                    eval_end();
+                    break;
+
+                case BLOCK_DROP:
+                    eval_drop();
+                    break;
+
+                case BLOCK_DUP:
+                    if (decision_at[ip - 1 - bf->code_ptr] >= 0) {
+                        eval_match(decisions[decision_at[ip - 1 - bf->code_ptr]]);
+                    } else {
+                        eval_dup();
+                    }
+                    break;
 
-            case BLOCK_DATE:
-                switch (x) {
-                    case BLOCK_CONST:
-                        eval_const(INT);
-                        break;
+                case BLOCK_SWAP:
+                    eval_swap();
+                    break;
 
-                    case BLOCK_STRING:
-                        eval_string(STRING);
-                        break;
+                case BLOCK_ELEM:
+                    eval_elem();
+                    break;
 
-                    case BLOCK_SEXP:
-                        str = STRING;
-                        eval_sexp(str, INT);
-                        break;
+                default:
+                    FAIL;
+            }
+            break;
 
-                    case BLOCK_STA:
-                        eval_sta();
-                        break;
+        case LD:
+            eval_ld(l, INT);
+            break;
+        case LDA:
+            eval_lda(l, INT);
+            break;
+        case ST:
+            eval_st(l, INT);
+            break;
 
-                    case BLOCK_JMP:
-                        eval_jmp(INT);
-                        break;
+        case BLOCK_MOVE:
+            switch (x) {
+                case CJMPZ:
+                    eval_cjmpz(INT);
+                    break;
+
+                case CJMPNZ:
+                    eval_cjmpnz(INT);
+                    break;
+
+                case BEGIN:
+                case CBEGIN:
+                    arg1 = INT;
+                    eval_begin(arg1, INT);
+                    break;
+
+                case CLOSUSRE:
+                    arg1 = INT;
+                    eval_closure(arg1, INT);
+                    break;
+
+                case CALLC:
+                    eval_callc(INT);
+                    break;
+
+                case CALL:
+                    arg1 = INT;
+                    eval_call(arg1, INT);
+                    break;
+
+                case PLACE_TAG: {
+                    const sexp_info &sexp = sexps[sexp_at[ip - 1 - bf->code_ptr]];
+                    ip += 2 * sizeof(int32_t);
+                    eval_tag<fuse>(sexp);
+                    break;
+                }
 
-                    case BLOCK_END:
-                        eval_end();
-                        break;
+                case ARRAY:
+                    eval_array(INT);
+                    break;
 
-                    case BLOCK_DROP:
-                        eval_drop();
-                        break;
+                case CALL_FAIL:
+                    arg1 = INT;
+                    eval_fail(arg1, INT);
+                    break;
 
-                    case BLOCK_DUP:
-                        eval_dup();
-                        break;
+                case LINE:
+                    eval_line(INT);
+                    break;
 
-                    case BLOCK_SWAP:
-                        eval_swap();
-                        break;
+                default:
+                    FAIL;
+            }
+            break;
 
-                    case BLOCK_ELEM:
-                        eval_elem();
-                        break;
+        case PATT:
+            switch (x) {
+                case PATT_BSTRING:
+                    eval_patt_string();
+                    break;
+                case PATT_BSTRING_T:
+                    eval_patt<fuse, has_kind<STRING_TAG>>();
+                    break;
+                case PATT_BARRAY_T:
+                    eval_patt<fuse, has_kind<ARRAY_TAG>>();
+                    break;
+                case PATT_BSEXP_T:
+                    eval_patt<fuse, has_kind<SEXP_TAG>>();
+                    break;
+                case PATT_BBOXED:
+                    eval_patt<fuse, is_reference>();
+                    break;
+                case PATT_BUNBOXED:
+                    eval_patt<fuse, is_integer>();
+                    break;
+                case PATT_BCLOSURE_T:
+                    eval_patt<fuse, has_kind<CLOSURE_TAG>>();
+                    break;
+                default:
+                    FAIL;
+            }
+            break;
 
-                    default:
-                        FAIL;
-                }
-                break;
+        case BLOCK_CALL: {
+            switch (x) {
+                case CALL_LREAD:
+                    eval_call_lread();
+                    break;
 
-            case LD:
-                eval_ld(l, INT);
-                break;
-            case LDA:
-                eval_lda(l, INT);
-                break;
-            case ST:
-                eval_st(l, INT);
-                break;
+                case CALL_LWRITE:
+                    eval_call_lwrite();
+                    break;
 
-            case BLOCK_MOVE:
-                switch (x) {
-                    case CJMPZ:
-                        eval_cjmpz(INT);
-                        break;
+                case CALL_LLENGTH:
+                    eval_call_llength();
+                    break;
 
-                    case CJMPNZ:
-                        eval_cjmpnz(INT);
-                        break;
+                case CALL_LSRTING:
+                    eval_call_lstring();
+                    break;
 
-                    case BEGIN:
-                    case CBEGIN:
-                        arg1 = INT;
-                        eval_begin(arg1, INT);
-                        break;
+                case CALL_BARRAY:
+                    eval_call_barray(INT);
+                    break;
 
-                    case CLOSUSRE:
-                        arg1 = INT;
-                        eval_closure(arg1, INT);
-                        break;
+                default:
+                    FAIL;
+            }
+        }
+            break;
 
-                    case CALLC:
-                        eval_callc(INT);
-                        break;
+        default:
+            FAIL;
+    }
+    return true;
+}
 
-                    case CALL:
-                        arg1 = INT;
-                        eval_call(arg1, INT);
-                        break;
+void iterative_interpreter::run_registers() {
+    using namespace register_ir;
+    instruction *pc = registers->entry(0);
+    while (true) {
+        switch (pc->op) {
+            case IR_MOV:
+                fp[pc->dst] = fp[pc->a];
+                break;
 
-                    case PLACE_TAG:
-                        str = STRING;
-                        eval_tag(str, INT);
-                        break;
+            case IR_LOADI:
+                fp[pc->dst] = box(pc->a);
+                break;
 
-                    case ARRAY:
-                        eval_array(INT);
-                        break;
+            case IR_LOADG:
+                fp[pc->dst] = *global(pc->a);
+                break;
 
-                    case CALL_FAIL:
-                        arg1 = INT;
-                        eval_fail(arg1, INT);
-                        break;
+            case IR_STOREG:
+                *global(pc->dst) = fp[pc->a];
+                break;
 
-                    case LINE:
-                        eval_line(INT);
+            case IR_ADD:
+            case IR_SUB:
+            case IR_MUL:
+            case IR_CMP:
+            case IR_BINOP:
+            case IR_JCMPZ:
+            case IR_JCMPNZ: {
+                word x = fp[pc->a], y = fp[pc->b];
+                switch (pc->op) {
+                    case IR_ADD:
+                        fp[pc->dst] = x + y - 1;
+                        break;
+                    case IR_SUB:
+                        fp[pc->dst] = x - y + 1;
+                        break;
+                    case IR_MUL:
+                        fp[pc->dst] = (x - 1) * unbox(y) + 1;
+                        break;
+                    case IR_CMP:
+                        fp[pc->dst] = box(apply_binop(pc->cmp, x, y));
+                        break;
+                    case IR_BINOP:
+                        fp[pc->dst] = box(apply_binop(pc->cmp, unbox(x), unbox(y)));
                         break;
-
                     default:
-                        FAIL;
+                        if ((apply_binop(pc->cmp, x, y) != 0) == (pc->op == IR_JCMPNZ)) {
+                            pc = registers->at(pc->dst);
+                            continue;
+                        }
                 }
                 break;
+            }
 
-            case PATT:
-                eval_patt(x);
-                break;
+            case IR_JMP:
+                pc = registers->at(pc->dst);
+                continue;
 
-            case BLOCK_CALL: {
-                switch (x) {
-                    case CALL_LREAD:
-                        eval_call_lread();
-                        break;
+            case IR_CJMPZ:
+            case IR_CJMPNZ:
+                if ((unbox(fp[pc->a]) != 0) == (pc->op == IR_CJMPNZ)) {
+                    pc = registers->at(pc->dst);
+                    continue;
+                }
+                break;
 
-                    case CALL_LWRITE:
-                        eval_call_lwrite();
-                        break;
+            case IR_SWAP:
+                std::swap(fp[pc->a], fp[pc->b]);
+                break;
 
-                    case CALL_LLENGTH:
-                        eval_call_llength();
-                        break;
+            case IR_BEGIN:
+                stack::push(compress(fp));
+                fp = stack::get_stack_top();
+                stack::reserve(pc->a + pc->b);
+                stack::set_stack_top(fp - pc->a);
+                break;
 
-                    case CALL_LSRTING:
-                        eval_call_lstring();
-                        break;
+            case IR_END: {
+                word result = fp[pc->a];
+                word *frame = fp;
+                fp = decompress<word>(frame[0]);
+                int32_t ret = frame[2];
+                stack::set_stack_top(frame + frame[1] + 2);
+                stack::top() = result;
+                if (ret == 0) {
+                    return;
+                }
+                pc = registers->at(ret);
+                continue;
+            }
 
-                    case CALL_BARRAY:
-                        eval_call_barray(INT);
-                        break;
+            case IR_CALL:
+                stack::set_stack_top(fp + pc->b);
+                stack::reverse(pc->a);
+                stack::push(pc + 1 - registers->at(0));
+                stack::push(pc->a);
+                pc = registers->at(pc->dst);
+                continue;
+
+            case IR_TAIL_CALL:
+                stack::set_stack_top(fp + pc->b);
+                stack::reverse(pc->a);
+                reuse_frame(pc->a);
+                stack::push(pc->a);
+                pc = registers->at(pc->dst);
+                continue;
+
+            case IR_CALLC: {
+                stack::set_stack_top(fp + pc->b);
+                auto label = reinterpret_cast<char *>(Belem(decompress<word>(stack::peek(pc->a)), box(0)));
+                stack::reverse(pc->a);
+                stack::push(pc + 1 - registers->at(0));
+                stack::push(pc->a + 1);
+                pc = registers->entry(label - bf->code_ptr);
+                continue;
+            }
 
-                    default:
-                        FAIL;
-                }
+            case IR_TAIL_CALLC: {
+                stack::set_stack_top(fp + pc->b);
+                auto label = reinterpret_cast<char *>(Belem(decompress<word>(stack::peek(pc->a)), box(0)));
+                stack::reverse(pc->a);
+                reuse_frame(pc->a + 1);
+                stack::push(pc->a + 1);
+                pc = registers->entry(label - bf->code_ptr);
+                continue;
             }
+
+            case IR_STACK:
+                // without fusion: a following jump is run by the IR
+                stack::set_stack_top(fp + pc->b);
+                ip = bf->code_ptr + pc->offset;
+                step<false>();
                 break;
 
-            default:
-                FAIL;
+            case IR_STOP:
+                return;
         }
-    } while (ip != nullptr);
+        pc++;
+    }
 }
-
-
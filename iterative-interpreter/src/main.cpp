@@ -1,8 +1,128 @@
 #include "iterative_interpreter.h"
+#include "verifier.h"
+#include "profiler.h"
+#include "annotations.h"
+#include "register_ir.h"
+#include "snapshot.h"
+#include <chrono>
+#include <cstring>
+#include <string>
+
+using startup_clock = std::chrono::steady_clock;
+
+static double elapsed_ms(startup_clock::time_point from, startup_clock::time_point to) {
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
 
 int main(int argc, char* argv[]) {
-    bytefile *f = read_file (argv[1]);
-    auto interpreter = iterative_interpreter(f);
-    interpreter.eval();
+    bool startup_stats = false;
+    bool profile = false;
+    bool ngrams = false;
+    bool registers = false;
+    bool trusted = false;
+    char *annotations_name = nullptr;
+    char *snapshot_name = nullptr;
+    char *snapshot_offset = nullptr;
+    char *restore_name = nullptr;
+    char *file_name = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--startup-stats") == 0) {
+            startup_stats = true;
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            profile = true;
+        } else if (strcmp(argv[i], "--ngrams") == 0) {
+            ngrams = true;
+        } else if (strcmp(argv[i], "--registers") == 0) {
+            registers = true;
+        } else if (strcmp(argv[i], "--annotations") == 0 && i + 1 < argc) {
+            annotations_name = argv[++i];
+        } else if (strcmp(argv[i], "--trusted") == 0) {
+            trusted = true;
+        } else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+            snapshot_name = argv[++i];
+        } else if (strcmp(argv[i], "--snapshot-at") == 0 && i + 1 < argc) {
+            snapshot_offset = argv[++i];
+        } else if (strcmp(argv[i], "--restore") == 0 && i + 1 < argc) {
+            restore_name = argv[++i];
+        } else {
+            file_name = argv[i];
+        }
+    }
+
+    if (file_name == nullptr) {
+        failure("usage: %s [--startup-stats] [--profile] [--ngrams] [--registers] [--trusted] [--annotations <file.bc.types>] "
+                "[--snapshot <file> --snapshot-at <offset>] [--restore <file>] <file.bc>\n", argv[0]);
+    }
+    if (registers && (profile || ngrams)) {
+        failure("--registers cannot be combined with --profile or --ngrams\n");
+    }
+    if ((snapshot_name == nullptr) != (snapshot_offset == nullptr)) {
+        failure("--snapshot and --snapshot-at go together\n");
+    }
+    if (snapshot_name != nullptr && (registers || profile || ngrams || restore_name != nullptr)) {
+        failure("--snapshot cannot be combined with --registers, --profile, --ngrams or --restore\n");
+    }
+    if (restore_name != nullptr && registers) {
+        failure("--restore cannot be combined with --registers\n");
+    }
+
+    auto start = startup_clock::now();
+    snapshot::reservation ranges = {};
+    if (restore_name != nullptr) {
+        ranges = snapshot::reserve(restore_name);
+    }
+    bytefile *f = read_file(file_name);
+    auto loaded = startup_clock::now();
+    auto stacks = verifier::verify(f);
+    auto verified = startup_clock::now();
+    auto prof = profile || ngrams ? new profiler(f, ngrams) : nullptr;
+    auto notes = annotations_name != nullptr ? new annotations(f, annotations_name) : nullptr;
+    auto program = registers ? new register_ir::program(f, stacks, notes) : nullptr;
+    auto context = runtime_context_create(stdin, stdout, !trusted, nullptr);
+    auto interpreter = new iterative_interpreter(f, stacks, prof, notes, program, context);
+    if (snapshot_name != nullptr) {
+        char *end;
+        long offset = strtol(snapshot_offset, &end, 0);
+        if (*end != 0 || offset < 0 || offset >= f->file_ptr + f->file_size - f->code_ptr
+            || !stacks.reachable(offset)) {
+            failure("--snapshot-at: %s is not a reachable instruction\n", snapshot_offset);
+        }
+        interpreter->snapshot_at(offset, snapshot_name);
+    }
+    if (restore_name != nullptr) {
+        interpreter->restore(restore_name, ranges);
+    }
+    auto initialized = startup_clock::now();
+    interpreter->eval();
+    auto evaluated = startup_clock::now();
+    if (profile) {
+        prof->report(stderr);
+    }
+    if (ngrams) {
+        std::string ngrams_name = std::string(file_name) + ".ngrams";
+        FILE *out = fopen(ngrams_name.c_str(), "w");
+        if (out == nullptr) {
+            failure("cannot open %s for writing\n", ngrams_name.c_str());
+        }
+        prof->write_ngrams(out);
+        fclose(out);
+    }
+    size_t arena_size = arena_peak(f->arena_ptr), arena_space = arena_reserved(f->arena_ptr);
+    // the interpreter releases the arena, which the others allocate in
+    delete prof;
+    delete notes;
+    delete program;
+    delete interpreter;
+    auto finished = startup_clock::now();
+
+    if (startup_stats) {
+        fprintf(stderr, "load:     %10.3f ms\n", elapsed_ms(start, loaded));
+        fprintf(stderr, "verify:   %10.3f ms\n", elapsed_ms(loaded, verified));
+        fprintf(stderr, "init:     %10.3f ms\n", elapsed_ms(verified, initialized));
+        fprintf(stderr, "eval:     %10.3f ms\n", elapsed_ms(initialized, evaluated));
+        fprintf(stderr, "teardown: %10.3f ms\n", elapsed_ms(evaluated, finished));
+        fprintf(stderr, "arena:    %10zu bytes at peak, %zu reserved\n", arena_size, arena_space);
+    }
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,265 @@
+#include "profiler.h"
+#include "opcodes.h"
+#include <algorithm>
+#include <map>
+
+namespace {
+
+    struct entry {
+        int32_t offset;
+        int32_t end;
+        uint64_t count;
+        uint64_t cycles;
+    };
+
+    bool hotter(const entry &a, const entry &b) {
+        return a.cycles > b.cycles || (a.cycles == b.cycles && a.count > b.count);
+    }
+
+    double share(uint64_t part, uint64_t total) {
+        return total == 0 ? 0.0 : 100.0 * part / total;
+    }
+
+    uint64_t total(const arena_vector<uint64_t> &values) {
+        uint64_t sum = 0;
+        for (auto value: values) {
+            sum += value;
+        }
+        return sum;
+    }
+}
+
+profiler::profiler(bytefile *file, bool ngrams) : bf(file), counts(arena_allocator<uint64_t>(file->arena_ptr)),
+                                                   cycles(arena_allocator<uint64_t>(file->arena_ptr)), ngrams(ngrams),
+                                                   next_offset(arena_allocator<int32_t>(file->arena_ptr)),
+                                                   bigrams(arena_allocator<uint64_t>(file->arena_ptr)),
+                                                   trigrams(arena_allocator<uint64_t>(file->arena_ptr)),
+                                                   expected(-1), prev1(-1), prev2(-1),
+                                                   sampled(-1), sample_start(0), seed(2463534242u) {
+    code_size = bf->file_ptr + bf->file_size - bf->code_ptr;
+    counts.assign(code_size, 0);
+    cycles.assign(code_size, 0);
+    countdown = next_countdown();
+
+    if (ngrams) {
+        next_offset.assign(code_size, -1);
+        std::fill(std::begin(dense), std::end(dense), -1);
+        char *ip = bf->code_ptr;
+        while (ip != nullptr && ip < bf->code_ptr + code_size) {
+            auto opcode = (uint8_t) *ip;
+            if (dense[opcode] < 0) {
+                if (opcode_bytes.size() == NGRAM_ALPHABET) {
+                    failure("PROFILER: too many distinct opcodes\n");
+                }
+                dense[opcode] = opcode_bytes.size();
+                opcode_bytes.push_back(opcode);
+                opcode_names.push_back(opcode_name(ip));
+            }
+            char *next = disassemble_instruction(nullptr, bf, ip);
+            if (next != nullptr) {
+                next_offset[ip - bf->code_ptr] = next - bf->code_ptr;
+            }
+            ip = next;
+        }
+        bigrams.assign(NGRAM_ALPHABET * NGRAM_ALPHABET, 0);
+        trigrams.assign(NGRAM_ALPHABET * NGRAM_ALPHABET * NGRAM_ALPHABET, 0);
+    }
+}
+
+// Random interval with mean PROFILE_SAMPLE_PERIOD, so that samples do not
+// lock onto loops whose body length divides the period
+int32_t profiler::next_countdown() {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return 1 + seed % (2 * PROFILE_SAMPLE_PERIOD - 1);
+}
+
+std::string profiler::describe(char *ip) {
+    char *text = nullptr;
+    size_t size = 0;
+    FILE *stream = open_memstream(&text, &size);
+    if (disassemble_instruction(stream, bf, ip) == nullptr) {
+        fprintf(stream, "STOP");
+    }
+    fclose(stream);
+    std::string result(text, size);
+    free(text);
+    return result;
+}
+
+// The mnemonic without operands, keeping what the opcode byte itself encodes:
+// the operator of BINOP, the pattern of PATT, the callee of builtin calls
+// and the variable kind of LD/LDA/ST
+std::string profiler::opcode_name(char *ip) {
+    std::string name = describe(ip);
+    char h = (*ip & 0xF0) >> 4;
+    size_t end = name.find('\t');
+    if (end != std::string::npos && (h == BINOP || h == PATT || h == BLOCK_CALL)) {
+        end = name.find('\t', end + 1);
+    } else if (h == LD || h == LDA || h == ST) {
+        end = name.find('(');
+    }
+    name = name.substr(0, end);
+    std::replace(name.begin(), name.end(), '\t', ' ');
+    return name;
+}
+
+void profiler::report_opcodes(FILE *f) {
+    std::map<unsigned char, entry> opcodes;
+    for (int32_t offset = 0; offset < code_size; offset++) {
+        if (counts[offset] == 0) continue;
+        auto &e = opcodes.emplace(bf->code_ptr[offset], entry{offset, offset, 0, 0}).first->second;
+        e.count += counts[offset];
+        e.cycles += cycles[offset];
+    }
+
+    std::vector<entry> sorted;
+    for (auto &[_, e]: opcodes) {
+        sorted.push_back(e);
+    }
+    std::sort(sorted.begin(), sorted.end(), hotter);
+
+    uint64_t all_counts = total(counts), all_cycles = total(cycles);
+    fprintf(f, "=== opcodes ===\n");
+    fprintf(f, "%6s %14s %7s %16s %7s  %s\n", "code", "count", "%", "cycles", "%", "opcode");
+    for (auto &e: sorted) {
+        std::string name = opcode_name(bf->code_ptr + e.offset);
+        fprintf(f, "  0x%.2x %14llu %6.2f%% %16llu %6.2f%%  %s\n", (unsigned char) bf->code_ptr[e.offset],
+                (unsigned long long) e.count, share(e.count, all_counts),
+                (unsigned long long) e.cycles, share(e.cycles, all_cycles), name.c_str());
+    }
+}
+
+void profiler::report_functions(FILE *f) {
+    std::vector<entry> functions;
+    char *ip = bf->code_ptr;
+    while (ip != nullptr && ip < bf->code_ptr + code_size) {
+        int32_t offset = ip - bf->code_ptr;
+        if (*ip == BEGIN || *ip == CBEGIN) {
+            functions.push_back({offset, offset, 0, 0});
+        }
+        if (!functions.empty()) {
+            functions.back().end = offset;
+            functions.back().count += counts[offset];
+            functions.back().cycles += cycles[offset];
+        }
+        ip = disassemble_instruction(nullptr, bf, ip);
+    }
+    std::sort(functions.begin(), functions.end(), hotter);
+
+    std::map<int32_t, const char *> names;
+    for (int i = 0; i < bf->public_symbols_number; i++) {
+        names[get_public_offset(bf, i)] = get_public_name(bf, i);
+    }
+
+    uint64_t all_counts = total(counts), all_cycles = total(cycles);
+    fprintf(f, "=== functions ===\n");
+    fprintf(f, "%10s %14s %7s %16s %7s  %s\n", "begin", "count", "%", "cycles", "%", "name");
+    for (size_t i = 0; i < functions.size() && i < PROFILE_REPORT_LIMIT; i++) {
+        auto &e = functions[i];
+        if (e.count == 0) break;
+        auto name = names.find(e.offset);
+        fprintf(f, "0x%.8x %14llu %6.2f%% %16llu %6.2f%%  %s\n", e.offset,
+                (unsigned long long) e.count, share(e.count, all_counts),
+                (unsigned long long) e.cycles, share(e.cycles, all_cycles),
+                name == names.end() ? "" : name->second);
+    }
+}
+
+// A loop is the range between a backward jump and its target
+void profiler::report_loops(FILE *f) {
+    std::vector<entry> loops;
+    char *ip = bf->code_ptr;
+    while (ip != nullptr && ip < bf->code_ptr + code_size) {
+        int32_t offset = ip - bf->code_ptr;
+        if (*ip == BLOCK_JMP || *ip == CJMPZ || *ip == CJMPNZ) {
+            int32_t target = *reinterpret_cast<int32_t *>(ip + 1);
+            if (target >= 0 && target <= offset) {
+                entry loop = {target, offset, 0, 0};
+                for (int32_t i = target; i <= offset; i++) {
+                    loop.count += counts[i];
+                    loop.cycles += cycles[i];
+                }
+                loops.push_back(loop);
+            }
+        }
+        ip = disassemble_instruction(nullptr, bf, ip);
+    }
+    std::sort(loops.begin(), loops.end(), hotter);
+
+    uint64_t all_cycles = total(cycles);
+    fprintf(f, "=== loops ===\n");
+    fprintf(f, "%10s %10s %14s %14s %16s %7s\n", "header", "back-edge", "entries", "count", "cycles", "%");
+    for (size_t i = 0; i < loops.size() && i < PROFILE_REPORT_LIMIT; i++) {
+        auto &e = loops[i];
+        if (e.count == 0) break;
+        fprintf(f, "0x%.8x 0x%.8x %14llu %14llu %16llu %6.2f%%\n", e.offset, e.end,
+                (unsigned long long) counts[e.offset], (unsigned long long) e.count,
+                (unsigned long long) e.cycles, share(e.cycles, all_cycles));
+    }
+}
+
+void profiler::report_instructions(FILE *f) {
+    std::vector<entry> instructions;
+    for (int32_t offset = 0; offset < code_size; offset++) {
+        if (counts[offset] != 0) {
+            instructions.push_back({offset, offset, counts[offset], cycles[offset]});
+        }
+    }
+    std::sort(instructions.begin(), instructions.end(), hotter);
+
+    uint64_t all_counts = total(counts), all_cycles = total(cycles);
+    fprintf(f, "=== instructions ===\n");
+    fprintf(f, "%10s %14s %7s %16s %7s  %s\n", "offset", "count", "%", "cycles", "%", "instruction");
+    for (size_t i = 0; i < instructions.size() && i < PROFILE_REPORT_LIMIT; i++) {
+        auto &e = instructions[i];
+        fprintf(f, "0x%.8x %14llu %6.2f%% %16llu %6.2f%%  %s\n", e.offset,
+                (unsigned long long) e.count, share(e.count, all_counts),
+                (unsigned long long) e.cycles, share(e.cycles, all_cycles),
+                describe(bf->code_ptr + e.offset).c_str());
+    }
+}
+
+void profiler::report(FILE *f) {
+    fprintf(f, "instructions executed: %llu, cycles (sampled): %llu\n",
+            (unsigned long long) total(counts), (unsigned long long) total(cycles));
+    report_opcodes(f);
+    report_functions(f);
+    report_loops(f);
+    report_instructions(f);
+}
+
+void profiler::write_ngrams(FILE *f, int n, const arena_vector<uint64_t> &table) {
+    std::vector<std::pair<uint64_t, int32_t>> sorted;
+    for (size_t key = 0; key < table.size(); key++) {
+        if (table[key] != 0) {
+            sorted.emplace_back(table[key], key);
+        }
+    }
+    std::sort(sorted.begin(), sorted.end(), [](auto &a, auto &b) { return a.first > b.first; });
+
+    for (auto &[count, key]: sorted) {
+        int32_t ops[3];
+        for (int i = n - 1; i >= 0; i--) {
+            ops[i] = key % NGRAM_ALPHABET;
+            key /= NGRAM_ALPHABET;
+        }
+        fprintf(f, "%d\t%llu\t", n, (unsigned long long) count);
+        for (int i = 0; i < n; i++) {
+            fprintf(f, i == 0 ? "0x%.2x" : " 0x%.2x", opcode_bytes[ops[i]]);
+        }
+        fprintf(f, "\t");
+        for (int i = 0; i < n; i++) {
+            fprintf(f, i == 0 ? "%s" : "; %s", opcode_names[ops[i]].c_str());
+        }
+        fprintf(f, "\n");
+    }
+}
+
+// One line per n-gram: n, count, opcode bytes and mnemonics, separated by tabs
+void profiler::write_ngrams(FILE *f) {
+    fprintf(f, "# lama dynamic opcode n-grams\n");
+    write_ngrams(f, 2, bigrams);
+    write_ngrams(f, 3, trigrams);
+}
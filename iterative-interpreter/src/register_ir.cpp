@@ -0,0 +1,404 @@
+#include "register_ir.h"
+#include "annotations.h"
+#include "opcodes.h"
+#include "box.h"
+
+namespace register_ir {
+
+    namespace {
+
+        // An operand stack slot during translation: either a constant or a frame
+        // slot holding the value. The canonical place of slot d is fp[temp(d)];
+        // a LD of a local or an arg only records the variable's slot, and the
+        // value is copied to the canonical place when that becomes necessary.
+        struct value {
+            bool immediate;
+            int32_t v;
+        };
+
+        struct patch {
+            int32_t at;
+            int32_t target;
+        };
+
+        class translator {
+        public:
+            translator(bytefile *file, const verifier::stack_map &stacks, const annotations *notes,
+                       std::vector<instruction> &code, std::vector<int32_t> &entries)
+                    : bf(file), stacks(stacks), notes(notes), code(code), entries(entries) {}
+
+            void translate();
+
+        private:
+            bytefile *bf;
+            const verifier::stack_map &stacks;
+            const annotations *notes;
+            std::vector<instruction> &code;
+            std::vector<int32_t> &entries;
+
+            std::vector<int32_t> labels;
+            std::vector<patch> jumps;
+            std::vector<patch> calls;
+
+            // the function being translated
+            int32_t nlocals = 0;
+            std::vector<bool> leader;
+            std::vector<bool> pinned_locals; // address taken by LDA, so never aliased on the stack
+            std::vector<bool> pinned_args;
+            std::vector<value> stack;
+            int32_t producer = -1;           // instruction that wrote the canonical place of the top slot
+            int32_t offset = 0;              // of the bytecode instruction being translated
+
+            int32_t read_int(int32_t at, int n = 0);
+
+            int32_t temp(size_t d);
+
+            int32_t variable(char l, int32_t i);
+
+            void emit(opcode op, int32_t dst = 0, int32_t a = 0, int32_t b = 0, uint8_t cmp = 0);
+
+            void materialize(size_t d);
+
+            void flush();
+
+            void reset(size_t depth);
+
+            int32_t operand(size_t d);
+
+            void store(int32_t slot);
+
+            bool integer_operands();
+
+            void translate_function(int32_t begin, int32_t end, const std::vector<int32_t> &starts);
+
+            bool translate_instruction(int32_t next, bool &fused);
+        };
+
+        int32_t translator::read_int(int32_t at, int n) {
+            return *reinterpret_cast<int32_t *>(bf->code_ptr + at + 1 + n * sizeof(int32_t));
+        }
+
+        int32_t translator::temp(size_t d) {
+            return -nlocals - (int32_t) d - 1;
+        }
+
+        int32_t translator::variable(char l, int32_t i) {
+            return l == LOCAL ? -i - 1 : i + 3;
+        }
+
+        void translator::emit(opcode op, int32_t dst, int32_t a, int32_t b, uint8_t cmp) {
+            code.push_back({op, cmp, offset, dst, a, b});
+            producer = -1;
+        }
+
+        void translator::materialize(size_t d) {
+            value &v = stack[d];
+            if (v.immediate) {
+                emit(IR_LOADI, temp(d), v.v);
+            } else if (v.v != temp(d)) {
+                emit(IR_MOV, temp(d), v.v);
+            } else {
+                return;
+            }
+            v = {false, temp(d)};
+        }
+
+        // Brings every slot to its canonical place, as expected at jump targets,
+        // by calls and by the instructions run on the operand stack
+        void translator::flush() {
+            for (size_t d = 0; d < stack.size(); d++) {
+                materialize(d);
+            }
+        }
+
+        void translator::reset(size_t depth) {
+            stack.clear();
+            for (size_t d = 0; d < depth; d++) {
+                stack.push_back({false, temp(d)});
+            }
+            producer = -1;
+        }
+
+        int32_t translator::operand(size_t d) {
+            if (stack[d].immediate) {
+                materialize(d);
+            }
+            return stack[d].v;
+        }
+
+        // ST into a local or an arg; the stored value stays on top of the stack
+        void translator::store(int32_t slot) {
+            size_t top = stack.size() - 1;
+            value v = stack[top];
+            if (!v.immediate && v.v == slot) return;
+
+            bool aliased = false;
+            for (size_t d = 0; d < top; d++) {
+                if (!stack[d].immediate && stack[d].v == slot) {
+                    aliased = true;
+                }
+            }
+            if (!aliased && producer >= 0 && !v.immediate && v.v == temp(top) && code[producer].dst == v.v) {
+                // the instruction that computed the value writes the variable directly
+                code[producer].dst = slot;
+                stack[top] = {false, slot};
+                producer = -1;
+                return;
+            }
+            for (size_t d = 0; d < top; d++) {
+                if (!stack[d].immediate && stack[d].v == slot) {
+                    materialize(d);
+                }
+            }
+            if (v.immediate) {
+                emit(IR_LOADI, slot, v.v);
+            } else {
+                emit(IR_MOV, slot, v.v);
+            }
+        }
+
+        bool translator::integer_operands() {
+            return notes != nullptr && notes->integer_operands(offset);
+        }
+
+        // Returns whether control falls through to the next instruction; sets fused
+        // when the next instruction has been translated together with this one
+        bool translator::translate_instruction(int32_t next, bool &fused) {
+            char x = bf->code_ptr[offset],
+                    h = (x & 0xF0) >> 4,
+                    l = x & 0x0F;
+            size_t d = stack.size();
+
+            switch (h) {
+                case STOP:
+                    emit(IR_STOP);
+                    return false;
+
+                case BINOP: {
+                    int32_t a = operand(d - 2), b = operand(d - 1);
+                    stack.resize(d - 2);
+                    bool compare = x >= BINOP_LESS && x <= BINOP_NEQUAL;
+                    char n = bf->code_ptr[next];
+                    if (compare && (n == CJMPZ || n == CJMPNZ) && !leader[next]) {
+                        flush();
+                        jumps.push_back({(int32_t) code.size(), read_int(next)});
+                        emit(n == CJMPZ ? IR_JCMPZ : IR_JCMPNZ, 0, a, b, x);
+                        fused = true;
+                        return true;
+                    }
+                    opcode op = compare ? IR_CMP : IR_BINOP;
+                    // arithmetic on the tagged representation only where the operands are proven integers
+                    if (integer_operands()) {
+                        op = x == BINOP_ADD ? IR_ADD : x == BINOP_SUB ? IR_SUB : x == BINOP_PROD ? IR_MUL : op;
+                    }
+                    emit(op, temp(d - 2), a, b, x);
+                    producer = code.size() - 1;
+                    stack.push_back({false, temp(d - 2)});
+                    return true;
+                }
+
+                case LD:
+                    if ((l == LOCAL && !pinned_locals[read_int(offset)]) || (l == ARGS && !pinned_args[read_int(offset)])) {
+                        stack.push_back({false, variable(l, read_int(offset))});
+                        return true;
+                    }
+                    if (l == LOCAL || l == ARGS) {
+                        emit(IR_MOV, temp(d), variable(l, read_int(offset)));
+                    } else if (l == GLOBAL) {
+                        emit(IR_LOADG, temp(d), read_int(offset));
+                    } else {
+                        break;
+                    }
+                    producer = code.size() - 1;
+                    stack.push_back({false, temp(d)});
+                    return true;
+
+                case ST:
+                    if (l == LOCAL || l == ARGS) {
+                        store(variable(l, read_int(offset)));
+                        return true;
+                    }
+                    if (l == GLOBAL) {
+                        emit(IR_STOREG, read_int(offset), operand(d - 1));
+                        return true;
+                    }
+                    break;
+
+                default:
+                    break;
+            }
+
+            switch (x) {
+                case BLOCK_CONST:
+                    stack.push_back({true, read_int(offset)});
+                    return true;
+
+                case BLOCK_DROP:
+                    stack.pop_back();
+                    producer = -1;
+                    return true;
+
+                case BLOCK_DUP:
+                    stack.push_back(stack.back());
+                    producer = -1;
+                    return true;
+
+                case BLOCK_SWAP:
+                    flush();
+                    emit(IR_SWAP, 0, temp(d - 2), temp(d - 1));
+                    return true;
+
+                case BLOCK_JMP:
+                    flush();
+                    jumps.push_back({(int32_t) code.size(), read_int(offset)});
+                    emit(IR_JMP);
+                    return false;
+
+                case CJMPZ:
+                case CJMPNZ: {
+                    int32_t v = operand(d - 1);
+                    stack.pop_back();
+                    flush();
+                    jumps.push_back({(int32_t) code.size(), read_int(offset)});
+                    emit(x == CJMPZ ? IR_CJMPZ : IR_CJMPNZ, 0, v);
+                    return true;
+                }
+
+                case BLOCK_END:
+                    emit(IR_END, 0, operand(d - 1));
+                    return false;
+
+                case BEGIN:
+                case CBEGIN:
+                    return true;
+
+                case CALL:
+                    flush();
+                    calls.push_back({(int32_t) code.size(), read_int(offset)});
+                    if (stacks.tail_call(offset)) {
+                        emit(IR_TAIL_CALL, 0, read_int(offset, 1), -nlocals - (int32_t) d);
+                        fused = !leader[next];
+                        return false;
+                    }
+                    emit(IR_CALL, 0, read_int(offset, 1), -nlocals - (int32_t) d);
+                    reset(stacks.before(next).size());
+                    return true;
+
+                case CALLC:
+                    flush();
+                    if (stacks.tail_call(offset)) {
+                        emit(IR_TAIL_CALLC, 0, read_int(offset), -nlocals - (int32_t) d);
+                        fused = !leader[next];
+                        return false;
+                    }
+                    emit(IR_CALLC, 0, read_int(offset), -nlocals - (int32_t) d);
+                    reset(stacks.before(next).size());
+                    return true;
+
+                case LINE:
+                    return true;
+
+                default:
+                    break;
+            }
+
+            // everything else runs on the operand stack
+            flush();
+            emit(IR_STACK, 0, 0, -nlocals - (int32_t) d);
+            if (x == CALL_FAIL) {
+                return false;
+            }
+            reset(stacks.before(next).size());
+            return true;
+        }
+
+        void translator::translate_function(int32_t begin, int32_t end, const std::vector<int32_t> &starts) {
+            nlocals = read_int(begin, 1);
+            int32_t argc = read_int(begin, 0);
+            pinned_locals.assign(nlocals, false);
+            pinned_args.assign(argc, false);
+
+            size_t depth = 0;
+            for (int32_t at: starts) {
+                if (!stacks.reachable(at)) continue;
+                depth = std::max(depth, stacks.before(at).size() + 1);
+                char x = bf->code_ptr[at];
+                if (x == BLOCK_JMP || x == CJMPZ || x == CJMPNZ) {
+                    leader[read_int(at)] = true;
+                }
+                if (x == LDA + LOCAL) pinned_locals[read_int(at)] = true;
+                if (x == LDA + ARGS) pinned_args[read_int(at)] = true;
+            }
+
+            entries[begin] = code.size();
+            offset = begin;
+            emit(IR_BEGIN, 0, nlocals, depth);
+            reset(0);
+
+            bool live = true, fused = false;
+            for (size_t i = 1; i < starts.size(); i++) {
+                offset = starts[i];
+                int32_t next = i + 1 < starts.size() ? starts[i + 1] : end;
+                if (fused) {
+                    fused = false;
+                    continue;
+                }
+                if (!stacks.reachable(offset)) {
+                    live = false;
+                    continue;
+                }
+                if (leader[offset] || !live) {
+                    if (live) {
+                        flush();
+                    }
+                    reset(stacks.before(offset).size());
+                    labels[offset] = code.size();
+                }
+                live = translate_instruction(next, fused);
+            }
+        }
+
+        void translator::translate() {
+            int32_t code_size = bf->file_ptr + bf->file_size - bf->code_ptr;
+            labels.assign(code_size, -1);
+            leader.assign(code_size, false);
+
+            // split the code at every BEGIN/CBEGIN; the code ends with STOP
+            std::vector<int32_t> starts;
+            char *ip = bf->code_ptr;
+            while (true) {
+                int32_t at = ip - bf->code_ptr;
+                char x = *ip;
+                if (!starts.empty() && (x == BEGIN || x == CBEGIN || (x & 0xF0) >> 4 == STOP)) {
+                    translate_function(starts.front(), at, starts);
+                    starts.clear();
+                }
+                if ((x & 0xF0) >> 4 == STOP) {
+                    offset = at;
+                    emit(IR_STOP);
+                    break;
+                }
+                starts.push_back(at);
+                ip = disassemble_instruction(nullptr, bf, ip);
+            }
+
+            for (auto &j: jumps) {
+                code[j.at].dst = labels[j.target];
+            }
+            for (auto &c: calls) {
+                code[c.at].dst = entries[c.target];
+            }
+        }
+    }
+
+    // The code is translated into growing vectors, and copied to the arena
+    // once its size is known
+    program::program(bytefile *bf, const verifier::stack_map &stacks, const annotations *notes)
+            : code(arena_allocator<instruction>(bf->arena_ptr)), entries(arena_allocator<int32_t>(bf->arena_ptr)) {
+        std::vector<instruction> translated;
+        std::vector<int32_t> translated_entries(bf->file_ptr + bf->file_size - bf->code_ptr, -1);
+        translator(bf, stacks, notes, translated, translated_entries).translate();
+        code.assign(translated.begin(), translated.end());
+        entries.assign(translated_entries.begin(), translated_entries.end());
+    }
+}
@@ -19,19 +19,22 @@ void print_indent (void) {
 }
 #endif
 
-extern size_t __gc_stack_top, __gc_stack_bottom;
+extern __thread size_t __gc_stack_top, __gc_stack_bottom;
+
+/* The state of the runtime is thread-local: it belongs to the machine entered
+   on the current thread (see runtime_context) */
 
 /* GC pool structure and data; declared here in order to allow debug print */
 typedef struct {
-    size_t * begin;
-    size_t * end;
-    size_t * current;
+    word   * begin;
+    word   * end;
+    word   * current;
     size_t   size;
 } pool;
 
-static pool from_space;
-static pool to_space;
-size_t      *current;
+static __thread pool from_space;
+static __thread pool to_space;
+__thread word       *current;
 /* end */
 
 # ifdef __ENABLE_GC__
@@ -57,18 +60,39 @@ void __post_gc_subst () {}
 # define CLOSURE_TAG 0x00000007
 # define UNBOXED_TAG 0x00000009 // Not actually a tag; used to return from LkindOf
 
-# define LEN(x) ((x & 0xFFFFFFF8) >> 3)
-# define TAG(x)  (x & 0x00000007)
+# define LEN(x) (TAG(x) == SEXP_TAG ? SEXP_ARITY(x) : ((uword) (x)) >> 3)
+# define TAG(x)  ((x) & 0x00000007)
+
+/* A sexp header keeps the arity above the SEXP_PACKED bit. A sexp with a small
+   tag and arity is packed: its tag is in the bits of the header above the
+   arity, and the object is just the header and the fields. Any other sexp
+   keeps the tag in a word in front of the header (see sexp) */
+# define SEXP_PACKED          0x00000008
+# define SEXP_ARITY(x)        (((x) & SEXP_PACKED) ? (((uword) (x)) >> 4) & 0xFF : ((uword) (x)) >> 4)
+# define SEXP_HEADER(t, n)    ((word) (((uword) (t) << 12) | ((uword) (n) << 4) | SEXP_PACKED | SEXP_TAG))
+# define SEXP_HEADER_WORDS(x) (((x) & SEXP_PACKED) ? 1 : 2)
+# ifndef DEBUG_PRINT
+# define SEXP_FITS(t, n)      ((n) <= 0xFF && (uword) (t) < ((uword) 1 << (CHAR_BIT * sizeof(word) - 12)))
+# else // the heap is walked by printFromSpace, which expects a tag word in front of every sexp
+# define SEXP_FITS(t, n)      0
+# endif
+
+/* Cons cells of lists are packed sexps with the tag LtagHash ("cons") and two
+   fields, so a cell is told by its header alone */
+# define CONS_TAG             848787
+# define CONS_HEADER          (SEXP_FITS(CONS_TAG, 2) ? SEXP_HEADER(CONS_TAG, 2) : 0)
 
-# define TO_DATA(x) ((data*)((char*)(x)-sizeof(int)))
-# define TO_SEXP(x) ((sexp*)((char*)(x)-2*sizeof(int)))
+# define TO_DATA(x) ((data*)((char*)(x)-sizeof(word)))
+# define TO_SEXP(x) ((sexp*)((char*)(x)-2*sizeof(word)))
+# define SEXP_TAG_OF(x) \
+  ((TO_DATA(x)->tag & SEXP_PACKED) ? (word) (((uword) TO_DATA(x)->tag) >> 12) : TO_SEXP(x)->tag)
 # ifdef DEBUG_PRINT // GET_SEXP_TAG is necessary for printing from space
-# define GET_SEXP_TAG(x) (LEN(x))
+# define GET_SEXP_TAG(x) (((uword) (x)) >> 3)
 #endif
 
-# define UNBOXED(x)  (((int) (x)) &  0x0001)
-# define UNBOX(x)    (((int) (x)) >> 1)
-# define BOX(x)      ((((int) (x)) << 1) | 0x0001)
+# define UNBOXED(x)  (((word) (intptr_t) (x)) &  0x0001)
+# define UNBOX(x)    (((word) (intptr_t) (x)) >> 1)
+# define BOX(x)      ((((word) (intptr_t) (x)) << 1) | 0x0001)
 
 /* GC extra roots */
 # define MAX_EXTRA_ROOTS_NUMBER 32
@@ -77,7 +101,7 @@ typedef struct {
     void ** roots[MAX_EXTRA_ROOTS_NUMBER];
 } extra_roots_pool;
 
-static extra_roots_pool extra_roots;
+static __thread extra_roots_pool extra_roots;
 
 void clear_extra_roots (void) {
     extra_roots.current_free = 0;
@@ -126,7 +150,22 @@ void pop_extra_root (void ** p) {
 
 /* end */
 
+/* The streams of the machine, used by read, write, readLine and printf */
+static __thread FILE *runtime_in, *runtime_out;
+
+/* Called with the message of a failure instead of ending the process */
+static __thread void (*failure_handler) (const char *message);
+
 static void vfailure (char *s, va_list args) {
+    if (failure_handler != NULL) {
+        char    message[1024];
+        va_list copy;
+
+        va_copy   (copy, args);
+        vsnprintf (message, sizeof (message), s, copy);
+        va_end    (copy);
+        failure_handler (message);
+    }
     fprintf  (stderr, "*** FAILURE: ");
     vfprintf (stderr, s, args); // vprintf (char *, va_list) <-> printf (char *, ...)
     exit     (255);
@@ -139,6 +178,65 @@ void failure (const char *s, ...) {
     vfailure ((char *) s, args);
 }
 
+/* Regions released on this thread and kept for reuse (see runtime_cache_regions) */
+# define REGION_CACHE_SIZE 8
+typedef struct {
+    char   *begin;
+    size_t  size, guard;
+} cached_region;
+
+static __thread int           region_cache_enabled;
+static __thread int           region_cache_count;
+static __thread cached_region region_cache[REGION_CACHE_SIZE];
+
+extern void runtime_cache_regions (int enable) {
+    region_cache_enabled = enable;
+    if (enable) return;
+
+    while (region_cache_count > 0) {
+        cached_region *r = &region_cache[--region_cache_count];
+        munmap (r->begin - r->guard, r->size + 2 * r->guard);
+    }
+}
+
+extern void *reserve_region (size_t size, size_t guard) {
+    int i;
+
+    for (i = 0; i < region_cache_count; i++) {
+        if (region_cache[i].size == size && region_cache[i].guard == guard) {
+            char *p = region_cache[i].begin;
+            region_cache[i] = region_cache[--region_cache_count];
+            return p;
+        }
+    }
+
+    char *p = mmap (NULL, size + 2 * guard, PROT_NONE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | REGION_FLAGS, -1, 0);
+
+    if (p == MAP_FAILED) return MAP_FAILED;
+
+    if (mprotect (p + guard, size, PROT_READ | PROT_WRITE) == -1) {
+        munmap (p, size + 2 * guard);
+        return MAP_FAILED;
+    }
+
+    return p + guard;
+}
+
+extern void release_region (void *begin, size_t size, size_t guard) {
+    if (region_cache_enabled && region_cache_count < REGION_CACHE_SIZE) {
+        /* the pages are dropped, and read as zeros again like fresh ones */
+        if (madvise (begin, size, MADV_DONTNEED) == 0) {
+            cached_region *r = &region_cache[region_cache_count++];
+            r->begin = (char*) begin;
+            r->size  = size;
+            r->guard = guard;
+            return;
+        }
+    }
+    munmap ((char*) begin - guard, size + 2 * guard);
+}
+
 void Lassert (void *f, char *s, ...) {
     if (!UNBOX(f)) {
         va_list args;
@@ -148,29 +246,32 @@ void Lassert (void *f, char *s, ...) {
     }
 }
 
+__thread int runtime_checks = 1;
+
 # define ASSERT_BOXED(memo, x)               \
-  do if (UNBOXED(x)) failure ("boxed value expected in %s\n", memo); while (0)
+  do if (runtime_checks && UNBOXED(x)) failure ("boxed value expected in %s\n", memo); while (0)
 # define ASSERT_UNBOXED(memo, x)             \
-  do if (!UNBOXED(x)) failure ("unboxed value expected in %s\n", memo); while (0)
+  do if (runtime_checks && !UNBOXED(x)) failure ("unboxed value expected in %s\n", memo); while (0)
 # define ASSERT_STRING(memo, x)              \
-  do if (!UNBOXED(x) && TAG(TO_DATA(x)->tag) \
+  do if (runtime_checks && !UNBOXED(x) && TAG(TO_DATA(x)->tag) \
 	 != STRING_TAG) failure ("string value expected in %s\n", memo); while (0)
 
 typedef struct {
-    int tag;
+    word tag;
     char contents[0];
 } data;
 
+/* A sexp that is not packed (see SEXP_PACKED) */
 typedef struct {
-    int tag;
+    word tag;
     data contents;
 } sexp;
 
 extern void* alloc    (size_t);
-extern void* Bsexp    (int n, ...);
-extern int   LtagHash (char*);
+extern void* Bsexp    (word n, ...);
+extern word  LtagHash (char*);
 
-void *global_sysargs;
+__thread void *global_sysargs;
 
 // Gets a raw tag
 extern int LkindOf (void *p) {
@@ -180,7 +281,7 @@ extern int LkindOf (void *p) {
 }
 
 // Compare sexprs tags
-extern int LcompareTags (void *p, void *q) {
+extern word LcompareTags (void *p, void *q) {
     data *pd, *qd;
 
     ASSERT_BOXED ("compareTags, 0", p);
@@ -192,7 +293,7 @@ extern int LcompareTags (void *p, void *q) {
     if (TAG(pd->tag) == SEXP_TAG && TAG(qd->tag) == SEXP_TAG) {
         return
 #ifndef DEBUG_PRINT
-                BOX((TO_SEXP(p)->tag) - (TO_SEXP(q)->tag));
+                BOX(SEXP_TAG_OF(p) - SEXP_TAG_OF(q));
 #else
         BOX((GET_SEXP_TAG(TO_SEXP(p)->tag)) - (GET_SEXP_TAG(TO_SEXP(p)->tag)));
 #endif
@@ -210,7 +311,7 @@ void* Ls__Infix_58 (void *p, void *q) {
 
     push_extra_root(&p);
     push_extra_root(&q);
-    res = Bsexp (BOX(3), p, q, LtagHash ("cons")); //BOX(848787));
+    res = Bsexp (BOX(3), COMPRESS(p), COMPRESS(q), BOX(CONS_TAG));
     pop_extra_root(&q);
     pop_extra_root(&p);
 
@@ -220,7 +321,7 @@ void* Ls__Infix_58 (void *p, void *q) {
 }
 
 // Functional synonym for built-in operator "!!";
-int Ls__Infix_3333 (void *p, void *q) {
+word Ls__Infix_3333 (void *p, void *q) {
     ASSERT_UNBOXED("captured !!:1", p);
     ASSERT_UNBOXED("captured !!:2", q);
 
@@ -228,7 +329,7 @@ int Ls__Infix_3333 (void *p, void *q) {
 }
 
 // Functional synonym for built-in operator "&&";
-int Ls__Infix_3838 (void *p, void *q) {
+word Ls__Infix_3838 (void *p, void *q) {
     ASSERT_UNBOXED("captured &&:1", p);
     ASSERT_UNBOXED("captured &&:2", q);
 
@@ -236,12 +337,12 @@ int Ls__Infix_3838 (void *p, void *q) {
 }
 
 // Functional synonym for built-in operator "==";
-int Ls__Infix_6161 (void *p, void *q) {
+word Ls__Infix_6161 (void *p, void *q) {
     return BOX(p == q);
 }
 
 // Functional synonym for built-in operator "!=";
-int Ls__Infix_3361 (void *p, void *q) {
+word Ls__Infix_3361 (void *p, void *q) {
     ASSERT_UNBOXED("captured !=:1", p);
     ASSERT_UNBOXED("captured !=:2", q);
 
@@ -249,7 +350,7 @@ int Ls__Infix_3361 (void *p, void *q) {
 }
 
 // Functional synonym for built-in operator "<=";
-int Ls__Infix_6061 (void *p, void *q) {
+word Ls__Infix_6061 (void *p, void *q) {
     ASSERT_UNBOXED("captured <=:1", p);
     ASSERT_UNBOXED("captured <=:2", q);
 
@@ -257,7 +358,7 @@ int Ls__Infix_6061 (void *p, void *q) {
 }
 
 // Functional synonym for built-in operator "<";
-int Ls__Infix_60 (void *p, void *q) {
+word Ls__Infix_60 (void *p, void *q) {
     ASSERT_UNBOXED("captured <:1", p);
     ASSERT_UNBOXED("captured <:2", q);
 
@@ -265,7 +366,7 @@ int Ls__Infix_60 (void *p, void *q) {
 }
 
 // Functional synonym for built-in operator ">=";
-int Ls__Infix_6261 (void *p, void *q) {
+word Ls__Infix_6261 (void *p, void *q) {
     ASSERT_UNBOXED("captured >=:1", p);
     ASSERT_UNBOXED("captured >=:2", q);
 
@@ -273,7 +374,7 @@ int Ls__Infix_6261 (void *p, void *q) {
 }
 
 // Functional synonym for built-in operator ">";
-int Ls__Infix_62 (void *p, void *q) {
+word Ls__Infix_62 (void *p, void *q) {
     ASSERT_UNBOXED("captured >:1", p);
     ASSERT_UNBOXED("captured >:2", q);
 
@@ -281,7 +382,7 @@ int Ls__Infix_62 (void *p, void *q) {
 }
 
 // Functional synonym for built-in operator "+";
-int Ls__Infix_43 (void *p, void *q) {
+word Ls__Infix_43 (void *p, void *q) {
     ASSERT_UNBOXED("captured +:1", p);
     ASSERT_UNBOXED("captured +:2", q);
 
@@ -289,7 +390,7 @@ int Ls__Infix_43 (void *p, void *q) {
 }
 
 // Functional synonym for built-in operator "-";
-int Ls__Infix_45 (void *p, void *q) {
+word Ls__Infix_45 (void *p, void *q) {
     if (UNBOXED(p)) {
         ASSERT_UNBOXED("captured -:2", q);
         return BOX(UNBOX(p) - UNBOX(q));
@@ -300,7 +401,7 @@ int Ls__Infix_45 (void *p, void *q) {
 }
 
 // Functional synonym for built-in operator "*";
-int Ls__Infix_42 (void *p, void *q) {
+word Ls__Infix_42 (void *p, void *q) {
     ASSERT_UNBOXED("captured *:1", p);
     ASSERT_UNBOXED("captured *:2", q);
 
@@ -308,7 +409,7 @@ int Ls__Infix_42 (void *p, void *q) {
 }
 
 // Functional synonym for built-in operator "/";
-int Ls__Infix_47 (void *p, void *q) {
+word Ls__Infix_47 (void *p, void *q) {
     ASSERT_UNBOXED("captured /:1", p);
     ASSERT_UNBOXED("captured /:2", q);
 
@@ -316,14 +417,14 @@ int Ls__Infix_47 (void *p, void *q) {
 }
 
 // Functional synonym for built-in operator "%";
-int Ls__Infix_37 (void *p, void *q) {
+word Ls__Infix_37 (void *p, void *q) {
     ASSERT_UNBOXED("captured %:1", p);
     ASSERT_UNBOXED("captured %:2", q);
 
     return BOX(UNBOX(p) % UNBOX(q));
 }
 
-extern int Llength (void *p) {
+extern word Llength (void *p) {
     data *a = (data*) BOX (NULL);
 
     ASSERT_BOXED(".length", p);
@@ -336,7 +437,7 @@ static char* chars = "_abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ01234
 
 extern char* de_hash (int);
 
-extern int LtagHash (char *s) {
+extern word LtagHash (char *s) {
     char *p;
     int  h = 0, limit = 0;
 
@@ -363,7 +464,7 @@ extern int LtagHash (char *s) {
 
 char* de_hash (int n) {
     //  static char *chars = (char*) BOX (NULL);
-    static char buf[6] = {0,0,0,0,0,0};
+    static __thread char buf[6] = {0,0,0,0,0,0};
     char *p = (char *) BOX (NULL);
     p = &buf[5];
 
@@ -396,7 +497,7 @@ typedef struct {
     int len;
 } StringBuf;
 
-static StringBuf stringBuf;
+static __thread StringBuf stringBuf;
 
 # define STRINGBUF_INIT 128
 
@@ -454,10 +555,10 @@ int is_valid_heap_pointer (void *p);
 static void printValue (void *p) {
     data *a = (data*) BOX(NULL);
     int i   = BOX(0);
-    if (UNBOXED(p)) printStringBuf ("%d", UNBOX(p));
+    if (UNBOXED(p)) printStringBuf ("%ld", (long) UNBOX(p));
     else {
         if (! is_valid_heap_pointer(p)) {
-            printStringBuf ("0x%x", p);
+            printStringBuf ("%p", p);
             return;
         }
 
@@ -471,8 +572,8 @@ static void printValue (void *p) {
             case CLOSURE_TAG:
                 printStringBuf ("<closure ");
                 for (i = 0; i < LEN(a->tag); i++) {
-                    if (i) printValue ((void*)((int*) a->contents)[i]);
-                    else printStringBuf ("0x%x", (void*)((int*) a->contents)[i]);
+                    if (i) printValue (DECOMPRESS(((word*) a->contents)[i]));
+                    else printStringBuf ("%p", DECOMPRESS(((word*) a->contents)[i]));
 
                     if (i != LEN(a->tag) - 1) printStringBuf (", ");
                 }
@@ -482,7 +583,7 @@ static void printValue (void *p) {
             case ARRAY_TAG:
                 printStringBuf ("[");
                 for (i = 0; i < LEN(a->tag); i++) {
-                    printValue ((void*)((int*) a->contents)[i]);
+                    printValue (DECOMPRESS(((word*) a->contents)[i]));
                     if (i != LEN(a->tag) - 1) printStringBuf (", ");
                 }
                 printStringBuf ("]");
@@ -490,7 +591,7 @@ static void printValue (void *p) {
 
             case SEXP_TAG: {
 #ifndef DEBUG_PRINT
-                char * tag = de_hash (TO_SEXP(p)->tag);
+                char * tag = de_hash (SEXP_TAG_OF(p));
 #else
                 char * tag = de_hash (GET_SEXP_TAG(TO_SEXP(p)->tag));
 #endif
@@ -501,8 +602,8 @@ static void printValue (void *p) {
                     printStringBuf ("{");
 
                     while (LEN(a->tag)) {
-                        printValue ((void*)((int*) b->contents)[0]);
-                        b = (data*)((int*) b->contents)[1];
+                        printValue (DECOMPRESS(((word*) b->contents)[0]));
+                        b = (data*) DECOMPRESS(((word*) b->contents)[1]);
                         if (! UNBOXED(b)) {
                             printStringBuf (", ");
                             b = TO_DATA(b);
@@ -517,7 +618,7 @@ static void printValue (void *p) {
                     if (LEN(a->tag)) {
                         printStringBuf (" (");
                         for (i = 0; i < LEN(a->tag); i++) {
-                            printValue ((void*)((int*) a->contents)[i]);
+                            printValue (DECOMPRESS(((word*) a->contents)[i]));
                             if (i != LEN(a->tag) - 1) printStringBuf (", ");
                         }
                         printStringBuf (")");
@@ -527,7 +628,7 @@ static void printValue (void *p) {
                 break;
 
             default:
-                printStringBuf ("*** invalid tag: 0x%x ***", TAG(a->tag));
+                printStringBuf ("*** invalid tag: 0x%x ***", (int) TAG(a->tag));
         }
     }
 }
@@ -547,7 +648,7 @@ static void stringcat (void *p) {
 
             case SEXP_TAG: {
 #ifndef DEBUG_PRINT
-                char * tag = de_hash (TO_SEXP(p)->tag);
+                char * tag = de_hash (SEXP_TAG_OF(p));
 #else
                 char * tag = de_hash (GET_SEXP_TAG(TO_SEXP(p)->tag));
 #endif
@@ -555,8 +656,8 @@ static void stringcat (void *p) {
                     data *b = a;
 
                     while (LEN(a->tag)) {
-                        stringcat ((void*)((int*) b->contents)[0]);
-                        b = (data*)((int*) b->contents)[1];
+                        stringcat (DECOMPRESS(((word*) b->contents)[0]));
+                        b = (data*) DECOMPRESS(((word*) b->contents)[1]);
                         if (! UNBOXED(b)) {
                             b = TO_DATA(b);
                         }
@@ -568,22 +669,22 @@ static void stringcat (void *p) {
                 break;
 
             default:
-                printStringBuf ("*** invalid tag: 0x%x ***", TAG(a->tag));
+                printStringBuf ("*** invalid tag: 0x%x ***", (int) TAG(a->tag));
         }
     }
 }
 
-extern int Luppercase (void *v) {
+extern word Luppercase (void *v) {
     ASSERT_UNBOXED("Luppercase:1", v);
     return BOX(toupper ((int) UNBOX(v)));
 }
 
-extern int Llowercase (void *v) {
+extern word Llowercase (void *v) {
     ASSERT_UNBOXED("Llowercase:1", v);
     return BOX(tolower ((int) UNBOX(v)));
 }
 
-extern int LmatchSubString (char *subj, char *patt, int pos) {
+extern word LmatchSubString (char *subj, char *patt, word pos) {
     data *p = TO_DATA(patt), *s = TO_DATA(subj);
     int   n;
 
@@ -599,7 +700,7 @@ extern int LmatchSubString (char *subj, char *patt, int pos) {
     return BOX(strncmp (subj + UNBOX(pos), patt, n) == 0);
 }
 
-extern void* Lsubstring (void *subj, int p, int l) {
+extern void* Lsubstring (void *subj, word p, word l) {
     data *d = TO_DATA(subj);
     int pp = UNBOX (p), ll = UNBOX (l);
 
@@ -613,7 +714,7 @@ extern void* Lsubstring (void *subj, int p, int l) {
         __pre_gc ();
 
         push_extra_root (&subj);
-        r = (data*) alloc (ll + 1 + sizeof (int));
+        r = (data*) alloc (ll + 1 + sizeof (word));
         pop_extra_root (&subj);
 
         r->tag = STRING_TAG | (ll << 3);
@@ -626,7 +727,7 @@ extern void* Lsubstring (void *subj, int p, int l) {
     }
 
     failure ("substring: index out of bounds (position=%d, length=%d, \
-            subject length=%d)", pp, ll, LEN(d->tag));
+            subject length=%d)", pp, ll, (int) LEN(d->tag));
 }
 
 extern struct re_pattern_buffer *Lregexp (char *regexp) {
@@ -636,16 +737,16 @@ extern struct re_pattern_buffer *Lregexp (char *regexp) {
 
     memset (b, 0, sizeof (regex_t));
 
-    int n = (int) re_compile_pattern (regexp, strlen (regexp), b);
+    const char *e = re_compile_pattern (regexp, strlen (regexp), b);
 
-    if (n != 0) {
-        failure ("%", strerror (n));
+    if (e != NULL) {
+        failure ("regexp: %s\n", e);
     };
 
     return b;
 }
 
-extern int LregexpMatch (struct re_pattern_buffer *b, char *s, int pos) {
+extern word LregexpMatch (struct re_pattern_buffer *b, char *s, word pos) {
     int res;
 
     ASSERT_BOXED("regexpMatch:1", b);
@@ -671,7 +772,7 @@ void *Lclone (void *p) {
     void* res;
     int n;
 #ifdef DEBUG_PRINT
-    register int * ebp asm ("ebp");
+    void *ebp = __builtin_frame_address (0);
   indent++; print_indent ();
   printf ("Lclone arg: %p %p\n", &p, p); fflush (stdout);
 #endif
@@ -702,8 +803,8 @@ void *Lclone (void *p) {
                 print_indent ();
       printf ("Lclone: closure or array &p=%p p=%p ebp=%p\n", &p, p, ebp); fflush (stdout);
 #endif
-                obj = (data*) alloc (sizeof(int) * (l+1));
-                memcpy (obj, TO_DATA(p), sizeof(int) * (l+1));
+                obj = (data*) alloc (sizeof(word) * (l+1));
+                memcpy (obj, TO_DATA(p), sizeof(word) * (l+1));
                 res = (void*) (obj->contents);
                 break;
 
@@ -711,9 +812,10 @@ void *Lclone (void *p) {
 #ifdef DEBUG_PRINT
                 print_indent (); printf ("Lclone: sexp\n"); fflush (stdout);
 #endif
-                sobj = (sexp*) alloc (sizeof(int) * (l+2));
-                memcpy (sobj, TO_SEXP(p), sizeof(int) * (l+2));
-                res = (void*) sobj->contents.contents;
+                n = SEXP_HEADER_WORDS(a->tag);
+                sobj = (sexp*) alloc (sizeof(word) * (l+n));
+                memcpy (sobj, (word*) p - n, sizeof(word) * (l+n));
+                res = (void*) ((word*) sobj + n);
                 break;
 
             default:
@@ -734,16 +836,87 @@ void *Lclone (void *p) {
     return res;
 }
 
+/* Explicit traversal stack for Lcompare and inner_hash: each frame walks
+   the fields of one object (or of a pair of objects in Lcompare) */
+# define TRAVERSE_INLINE_FRAMES 32
+
+typedef struct {
+    word  *p;     /* fields of the (left) object                */
+    word  *q;     /* fields of the right object, Lcompare only  */
+    int    i;     /* next field to visit                        */
+    int    n;     /* number of fields                           */
+    int    depth; /* depth of the fields, inner_hash only       */
+} traverse_frame;
+
+typedef struct {
+    traverse_frame *frames;
+    int             size;
+    int             capacity;
+    traverse_frame  inline_frames[TRAVERSE_INLINE_FRAMES];
+} traverse_stack;
+
+static void traverse_init (traverse_stack *st) {
+    st->frames   = st->inline_frames;
+    st->size     = 0;
+    st->capacity = TRAVERSE_INLINE_FRAMES;
+}
+
+static void traverse_free (traverse_stack *st) {
+    if (st->frames != st->inline_frames) free (st->frames);
+}
+
+static void traverse_push (traverse_stack *st, word *p, word *q, int i, int n, int depth) {
+    traverse_frame *f;
+
+    if (st->size == st->capacity) {
+        int capacity = st->capacity << 1;
+
+        if (st->frames == st->inline_frames) {
+            f = (traverse_frame*) malloc (capacity * sizeof (traverse_frame));
+            if (f) memcpy (f, st->inline_frames, st->size * sizeof (traverse_frame));
+        }
+        else f = (traverse_frame*) realloc (st->frames, capacity * sizeof (traverse_frame));
+
+        if (f == NULL) failure ("*** FAILURE: unable to allocate memory.\n");
+
+        st->frames   = f;
+        st->capacity = capacity;
+    }
+
+    f = &st->frames[st->size++];
+    f->p     = p;
+    f->q     = q;
+    f->i     = i;
+    f->n     = n;
+    f->depth = depth;
+}
+
+/* Visits the frame's next field: the current frame is reused when it is the
+   last one (e.g. the tail of a cons cell), so lists are walked in constant stack */
+static void traverse_descend (traverse_stack *st, word *p, word *q, int i, int n, int depth) {
+    traverse_frame *f = &st->frames[st->size - 1];
+
+    if (f->i == f->n) {
+        f->p     = p;
+        f->q     = q;
+        f->i     = i;
+        f->n     = n;
+        f->depth = depth;
+    }
+    else traverse_push (st, p, q, i, n, depth);
+}
+
 # define HASH_DEPTH 3
-# define HASH_APPEND(acc, x) (((acc + (unsigned) x) << (WORD_SIZE / 2)) | ((acc + (unsigned) x) >> (WORD_SIZE / 2)))
+# define HASH_APPEND(acc, x) (((acc + (unsigned) (size_t) (x)) << (WORD_SIZE / 2)) | ((acc + (unsigned) (size_t) (x)) >> (WORD_SIZE / 2)))
 
-int inner_hash (int depth, unsigned acc, void *p) {
-    if (depth > HASH_DEPTH) return acc;
+/* Hashes a value without its fields; sets [*from, *n) to the fields still to be hashed */
+static unsigned hash_shallow (unsigned acc, void *p, int *from, int *n) {
+    *from = *n = 0;
 
     if (UNBOXED(p)) return HASH_APPEND(acc, UNBOX(p));
     else if (is_valid_heap_pointer (p)) {
         data *a = TO_DATA(p);
-        int t = TAG(a->tag), l = LEN(a->tag), i;
+        int t = TAG(a->tag), l = LEN(a->tag);
 
         acc = HASH_APPEND(acc, t);
         acc = HASH_APPEND(acc, l);
@@ -761,22 +934,20 @@ int inner_hash (int depth, unsigned acc, void *p) {
             }
 
             case CLOSURE_TAG:
-                acc = HASH_APPEND(acc, ((void**) a->contents)[0]);
-                i = 1;
+                acc = HASH_APPEND(acc, ((word*) a->contents)[0]);
+                *from = 1;
                 break;
 
             case ARRAY_TAG:
-                i = 0;
                 break;
 
             case SEXP_TAG: {
 #ifndef DEBUG_PRINT
-                int ta = TO_SEXP(p)->tag;
+                word ta = SEXP_TAG_OF(p);
 #else
                 int ta = GET_SEXP_TAG(TO_SEXP(p)->tag);
 #endif
                 acc = HASH_APPEND(acc, ta);
-                i = 0;
                 break;
             }
 
@@ -784,25 +955,61 @@ int inner_hash (int depth, unsigned acc, void *p) {
                 failure ("invalid tag %d in hash *****\n", t);
         }
 
-        for (; i<l; i++)
-            acc = inner_hash (depth+1, acc, ((void**) a->contents)[i]);
-
+        *n = l;
         return acc;
     }
     else return HASH_APPEND(acc, p);
 }
 
+int inner_hash (int depth, unsigned acc, void *p) {
+    traverse_stack st;
+    int from, n;
+
+    if (depth > HASH_DEPTH) return acc;
+
+    acc = hash_shallow (acc, p, &from, &n);
+    if (from == n || depth + 1 > HASH_DEPTH) return acc;
+
+    traverse_init (&st);
+    traverse_push (&st, (word*) p, NULL, from, n, depth + 1);
+
+    while (st.size) {
+        traverse_frame *f = &st.frames[st.size - 1];
+        void *x;
+
+        /* fast path: runs of unboxed fields, e.g. flat integer arrays */
+        while (f->i < f->n && UNBOXED(f->p[f->i])) {
+            acc = HASH_APPEND(acc, UNBOX(f->p[f->i]));
+            f->i++;
+        }
+
+        if (f->i == f->n) {
+            st.size--;
+            continue;
+        }
+
+        x = DECOMPRESS(f->p[f->i++]);
+        acc = hash_shallow (acc, x, &from, &n);
+
+        if (from < n && f->depth + 1 <= HASH_DEPTH)
+            traverse_descend (&st, (word*) x, NULL, from, n, f->depth + 1);
+    }
+
+    traverse_free (&st);
+    return acc;
+}
+
 extern void* LstringInt (char *b) {
     int n;
     sscanf (b, "%d", &n);
-    return (void*) BOX(n);
+    return DECOMPRESS(BOX(n));
 }
 
-extern int Lhash (void *p) {
+extern word Lhash (void *p) {
     return BOX(0x3fffff & inner_hash (0, 0, p));
 }
 
-extern int LflatCompare (void *p, void *q) {
+extern word LflatCompare (void *p, void *q) {
     if (UNBOXED(p)) {
         if (UNBOXED(q)) {
             return BOX (UNBOX(p) - UNBOX(q));
@@ -816,9 +1023,13 @@ extern int LflatCompare (void *p, void *q) {
     else BOX(1);
 }
 
-extern int Lcompare (void *p, void *q) {
+/* Compares two values without their fields; when both are heap objects with
+   equal headers returns BOX(0) and sets [*from, *n) to the fields to compare */
+static word compare_shallow (void *p, void *q, int *from, int *n) {
 # define COMPARE_AND_RETURN(x,y) do if (x != y) return BOX(x - y); while (0)
 
+    *from = *n = 0;
+
     if (p == q) return BOX(0);
 
     if (UNBOXED(p)) {
@@ -832,7 +1043,6 @@ extern int Lcompare (void *p, void *q) {
                 data *a = TO_DATA(p), *b = TO_DATA(q);
                 int ta = TAG(a->tag), tb = TAG(b->tag);
                 int la = LEN(a->tag), lb = LEN(b->tag);
-                int i;
 
                 COMPARE_AND_RETURN (ta, tb);
 
@@ -841,25 +1051,23 @@ extern int Lcompare (void *p, void *q) {
                         return BOX(strcmp (a->contents, b->contents));
 
                     case CLOSURE_TAG:
-                        COMPARE_AND_RETURN (((void**) a->contents)[0], ((void**) b->contents)[0]);
+                        COMPARE_AND_RETURN (((word*) a->contents)[0], ((word*) b->contents)[0]);
                         COMPARE_AND_RETURN (la, lb);
-                        i = 1;
+                        *from = 1;
                         break;
 
                     case ARRAY_TAG:
                         COMPARE_AND_RETURN (la, lb);
-                        i = 0;
                         break;
 
                     case SEXP_TAG: {
 #ifndef DEBUG_PRINT
-                        int ta = TO_SEXP(p)->tag, tb = TO_SEXP(q)->tag;
+                        word ta = SEXP_TAG_OF(p), tb = SEXP_TAG_OF(q);
 #else
                         int ta = GET_SEXP_TAG(TO_SEXP(p)->tag), tb = GET_SEXP_TAG(TO_SEXP(q)->tag);
 #endif
                         COMPARE_AND_RETURN (ta, tb);
                         COMPARE_AND_RETURN (la, lb);
-                        i = 0;
                         break;
                     }
 
@@ -867,11 +1075,7 @@ extern int Lcompare (void *p, void *q) {
                         failure ("invalid tag %d in compare *****\n", ta);
                 }
 
-                for (; i<la; i++) {
-                    int c = Lcompare (((void**) a->contents)[i], ((void**) b->contents)[i]);
-                    if (c != BOX(0)) return BOX(c);
-                }
-
+                *n = la;
                 return BOX(0);
             }
             else return BOX(-1);
@@ -879,9 +1083,55 @@ extern int Lcompare (void *p, void *q) {
         else if (is_valid_heap_pointer (q)) return BOX(1);
         else return BOX (p - q);
     }
+
+# undef COMPARE_AND_RETURN
+}
+
+extern word Lcompare (void *p, void *q) {
+    traverse_stack st;
+    int from, n;
+    word c;
+
+    c = compare_shallow (p, q, &from, &n);
+    if (c != BOX(0) || from == n) return c;
+
+    traverse_init (&st);
+    traverse_push (&st, (word*) p, (word*) q, from, n, 0);
+
+    while (st.size) {
+        traverse_frame *f = &st.frames[st.size - 1];
+        void *x, *y;
+
+        /* fast path: runs of unboxed fields, e.g. flat integer arrays */
+        while (f->i < f->n && UNBOXED(f->p[f->i]) && UNBOXED(f->q[f->i])) {
+            if (f->p[f->i] != f->q[f->i]) {
+                c = BOX(UNBOX(f->p[f->i]) - UNBOX(f->q[f->i]));
+                goto done;
+            }
+            f->i++;
+        }
+
+        if (f->i == f->n) {
+            st.size--;
+            continue;
+        }
+
+        x = DECOMPRESS(f->p[f->i]);
+        y = DECOMPRESS(f->q[f->i]);
+        f->i++;
+
+        c = compare_shallow (x, y, &from, &n);
+        if (c != BOX(0)) break;
+
+        if (from < n) traverse_descend (&st, (word*) x, (word*) y, from, n, 0);
+    }
+
+ done:
+    traverse_free (&st);
+    return c;
 }
 
-extern void* Belem_closure (void *p, int i) {
+extern void* Belem_closure (void *p, word i) {
     data *a = (data *)BOX(NULL);
 
     ASSERT_BOXED(".elem:1", p);
@@ -894,10 +1144,10 @@ extern void* Belem_closure (void *p, int i) {
         return a->contents + i;
     }
 
-    return ((int*) a->contents) + i;
+    return ((word*) a->contents) + i;
 }
 
-extern void* Belem (void *p, int i) {
+extern void* Belem (void *p, word i) {
     data *a = (data *)BOX(NULL);
 
     ASSERT_BOXED(".elem:1", p);
@@ -907,26 +1157,27 @@ extern void* Belem (void *p, int i) {
     i = UNBOX(i);
 
     if (TAG(a->tag) == STRING_TAG) {
-        return (void*) BOX(a->contents[i]);
+        return DECOMPRESS(BOX(a->contents[i]));
     }
 
-    return (void*) ((int*) a->contents)[i];
+    return DECOMPRESS(((word*) a->contents)[i]);
 }
 
-extern void* LmakeArray (int length) {
+extern void* LmakeArray (word length) {
     data *r;
-    int n, *p;
+    int n;
+    word *p;
 
     ASSERT_UNBOXED("makeArray:1", length);
 
     __pre_gc ();
 
     n = UNBOX(length);
-    r = (data*) alloc (sizeof(int) * (n+1));
+    r = (data*) alloc (sizeof(word) * (n+1));
 
     r->tag = ARRAY_TAG | (n << 3);
 
-    p = (int*) r->contents;
+    p = (word*) r->contents;
     while (n--) *p++ = BOX(0);
 
     __post_gc ();
@@ -934,7 +1185,7 @@ extern void* LmakeArray (int length) {
     return r->contents;
 }
 
-extern void* LmakeString (int length) {
+extern void* LmakeString (word length) {
     int   n = UNBOX(length);
     data *r;
 
@@ -942,7 +1193,7 @@ extern void* LmakeString (int length) {
 
     __pre_gc () ;
 
-    r = (data*) alloc (n + 1 + sizeof (int));
+    r = (data*) alloc (n + 1 + sizeof (word));
 
     r->tag = STRING_TAG | (n << 3);
 
@@ -1019,54 +1270,31 @@ extern void* Lstring (void *p) {
     return s;
 }
 
-extern void* Bclosure_arr (int bn, void *entry, int *values) {
-    int     i, ai;
-    register int * ebp asm ("ebp");
-    size_t  *argss;
+/* Allocates a closure with room for n captured values and stores its entry.
+   The caller writes the captures after the allocation, so none of them has
+   to be registered as an extra root */
+extern void* Bclosure_entry (word bn, void *entry) {
     data    *r;
     int     n = UNBOX(bn);
 
     __pre_gc ();
-#ifdef DEBUG_PRINT
-    indent++; print_indent ();
-  printf ("Bclosure: create n = %d\n", n); fflush(stdout);
-#endif
-    argss = (ebp + 12);
-    for (i = 0; i<n; i++, argss++) {
-        push_extra_root ((void**)argss);
-    }
 
-    r = (data*) alloc (sizeof(int) * (n+2));
+    r = (data*) alloc (sizeof(word) * (n+2));
 
     r->tag = CLOSURE_TAG | ((n + 1) << 3);
-    ((void**) r->contents)[0] = entry;
-
-    for (i = 0; i<n; i++) {
-        ai = values[i];
-        ((int*)r->contents)[i+1] = ai;
-    }
+    ((word*) r->contents)[0] = COMPRESS(entry);
 
     __post_gc();
 
-    argss--;
-    for (i = 0; i<n; i++, argss--) {
-        pop_extra_root ((void**)argss);
-    }
-
-#ifdef DEBUG_PRINT
-    print_indent ();
-  printf ("Bclosure: ends\n", n); fflush(stdout);
-  indent--;
-#endif
-
     return r->contents;
 }
 
-extern void* Bclosure (int bn, void *entry, ...) {
+/* The captured values have to be reachable from the roots of the caller,
+   as the elements of Barray and Bsexp */
+extern void* Bclosure (word bn, void *entry, ...) {
     va_list args;
-    int     i, ai;
-    register int * ebp asm ("ebp");
-    size_t  *argss;
+    int     i;
+    word    ai;
     data    *r;
     int     n = UNBOX(bn);
 
@@ -1075,32 +1303,22 @@ extern void* Bclosure (int bn, void *entry, ...) {
     indent++; print_indent ();
   printf ("Bclosure: create n = %d\n", n); fflush(stdout);
 #endif
-    argss = (ebp + 12);
-    for (i = 0; i<n; i++, argss++) {
-        push_extra_root ((void**)argss);
-    }
-
-    r = (data*) alloc (sizeof(int) * (n+2));
+    r = (data*) alloc (sizeof(word) * (n+2));
 
     r->tag = CLOSURE_TAG | ((n + 1) << 3);
-    ((void**) r->contents)[0] = entry;
+    ((word*) r->contents)[0] = COMPRESS(entry);
 
     va_start(args, entry);
 
     for (i = 0; i<n; i++) {
-        ai = va_arg(args, int);
-        ((int*)r->contents)[i+1] = ai;
+        ai = va_arg(args, word);
+        ((word*)r->contents)[i+1] = ai;
     }
 
     va_end(args);
 
     __post_gc();
 
-    argss--;
-    for (i = 0; i<n; i++, argss--) {
-        pop_extra_root ((void**)argss);
-    }
-
 #ifdef DEBUG_PRINT
     print_indent ();
   printf ("Bclosure: ends\n", n); fflush(stdout);
@@ -1110,8 +1328,9 @@ extern void* Bclosure (int bn, void *entry, ...) {
     return r->contents;
 }
 
-extern void* Barray_arr (int bn, int *values) {
-    int     i, ai;
+extern void* Barray_arr (word bn, word *values) {
+    int     i;
+    word    ai;
     data    *r;
     int     n = UNBOX(bn);
 
@@ -1121,13 +1340,13 @@ extern void* Barray_arr (int bn, int *values) {
     indent++; print_indent ();
   printf ("Barray: create n = %d\n", n); fflush(stdout);
 #endif
-    r = (data*) alloc (sizeof(int) * (n+1));
+    r = (data*) alloc (sizeof(word) * (n+1));
 
     r->tag = ARRAY_TAG | (n << 3);
 
     for (i = 0; i<n; i++) {
         ai = *(values++);
-        ((int*)r->contents)[i] = ai;
+        ((word*)r->contents)[i] = ai;
     }
 
     __post_gc();
@@ -1137,9 +1356,10 @@ extern void* Barray_arr (int bn, int *values) {
     return r->contents;
 }
 
-extern void* Barray (int bn, ...) {
+extern void* Barray (word bn, ...) {
     va_list args;
-    int     i, ai;
+    int     i;
+    word    ai;
     data    *r;
     int     n = UNBOX(bn);
 
@@ -1149,15 +1369,15 @@ extern void* Barray (int bn, ...) {
     indent++; print_indent ();
   printf ("Barray: create n = %d\n", n); fflush(stdout);
 #endif
-    r = (data*) alloc (sizeof(int) * (n+1));
+    r = (data*) alloc (sizeof(word) * (n+1));
 
     r->tag = ARRAY_TAG | (n << 3);
 
     va_start(args, bn);
 
     for (i = 0; i<n; i++) {
-        ai = va_arg(args, int);
-        ((int*)r->contents)[i] = ai;
+        ai = va_arg(args, word);
+        ((word*)r->contents)[i] = ai;
     }
 
     va_end(args);
@@ -1169,37 +1389,52 @@ extern void* Barray (int bn, ...) {
     return r->contents;
 }
 
-extern void* Bsexp_arr (int bn, int tag, int *values) {
+/* Allocates a sexp with n fields, packed when the tag and the arity fit
+   into the header; returns its fields */
+static word *alloc_sexp (int n, word tag) {
+    data *d;
+    sexp *r;
+
+    if (SEXP_FITS(tag, n)) {
+        d = (data*) alloc (sizeof(word) * (n+1));
+        d->tag = SEXP_HEADER(tag, n);
+        return (word*) d->contents;
+    }
+
+#ifdef DEBUG_PRINT
+    print_indent ();
+  printf("Bsexp: allocate %zu!\n",sizeof(word) * (n+2)); fflush (stdout);
+#endif
+    r = (sexp*) alloc (sizeof(word) * (n+2));
+    d = &(r->contents);
+
+    d->tag = SEXP_TAG | (n << 4);
+    r->tag = tag;
+
+#ifdef DEBUG_PRINT
+    r->tag = SEXP_TAG | ((r->tag) << 3);
+#endif
+
+    return (word*) d->contents;
+}
+
+extern void* Bsexp_arr (word bn, word tag, word *values) {
     int     i;
-    int     ai;
-    size_t *p;
-    sexp   *r;
-    data   *d;
+    word   *fields;
     int n = UNBOX(bn);
 
     __pre_gc () ;
 
 #ifdef DEBUG_PRINT
-    indent++; print_indent ();
-  printf("Bsexp: allocate %zu!\n",sizeof(int) * (n+1)); fflush (stdout);
+    indent++;
 #endif
-    r = (sexp*) alloc (sizeof(int) * (n+1));
-    d = &(r->contents);
-    r->tag = 0;
-
-    d->tag = SEXP_TAG | ((n-1) << 3);
+    fields = alloc_sexp (n-1, UNBOX(tag));
 
     for (i=0; i<n-1; i++) {
-        ai = *(values++);
-
-        p = (size_t*) ai;
-        ((int*)d->contents)[i] = ai;
+        fields[i] = *(values++);
     }
 
-    r->tag = UNBOX(tag);
-
 #ifdef DEBUG_PRINT
-    r->tag = SEXP_TAG | ((r->tag) << 3);
   print_indent ();
   printf("Bsexp: ends\n"); fflush (stdout);
   indent--;
@@ -1207,43 +1442,38 @@ extern void* Bsexp_arr (int bn, int tag, int *values) {
 
     __post_gc();
 
-    return d->contents;
+    return fields;
 }
 
-extern void* Bsexp (int bn, ...) {
-    va_list args;
+extern void* Bsexp (word bn, ...) {
+    va_list args, tag_args;
     int     i;
-    int     ai;
-    size_t *p;
-    sexp   *r;
-    data   *d;
+    word    tag;
+    word   *fields;
     int n = UNBOX(bn);
 
     __pre_gc () ;
 
-#ifdef DEBUG_PRINT
-    indent++; print_indent ();
-  printf("Bsexp: allocate %zu!\n",sizeof(int) * (n+1)); fflush (stdout);
-#endif
-    r = (sexp*) alloc (sizeof(int) * (n+1));
-    d = &(r->contents);
-    r->tag = 0;
-
-    d->tag = SEXP_TAG | ((n-1) << 3);
-
     va_start(args, bn);
 
+    /* the tag comes after the fields */
+    va_copy(tag_args, args);
     for (i=0; i<n-1; i++) {
-        ai = va_arg(args, int);
-
-        p = (size_t*) ai;
-        ((int*)d->contents)[i] = ai;
+        va_arg(tag_args, word);
     }
+    tag = UNBOX(va_arg(tag_args, word));
+    va_end(tag_args);
+
+#ifdef DEBUG_PRINT
+    indent++;
+#endif
+    fields = alloc_sexp (n-1, tag);
 
-    r->tag = UNBOX(va_arg(args, int));
+    for (i=0; i<n-1; i++) {
+        fields[i] = va_arg(args, word);
+    }
 
 #ifdef DEBUG_PRINT
-    r->tag = SEXP_TAG | ((r->tag) << 3);
   print_indent ();
   printf("Bsexp: ends\n"); fflush (stdout);
   indent--;
@@ -1253,17 +1483,44 @@ extern void* Bsexp (int bn, ...) {
 
     __post_gc();
 
-    return d->contents;
+    return fields;
 }
 
-extern int Btag (void *d, int t, int n) {
+/* A cons cell made of the two words on top of the interpreter stack: the
+   tail is on top and the head below it. They stay on the stack, where the
+   collector sees them, until the cell is allocated */
+extern void* Bcons (word *top) {
+    word *fields;
+
+    __pre_gc () ;
+
+    fields = alloc_sexp (2, CONS_TAG);
+    fields[0] = top[1];
+    fields[1] = top[0];
+
+    __post_gc();
+
+    return fields;
+}
+
+/* The header of a packed sexp with the tag t and n fields, or 0 if such sexps
+   are not packed; a sexp has this shape exactly when its header is equal to it */
+extern word Bsexp_header (word t, word n) {
+    return SEXP_FITS(UNBOX(t), UNBOX(n)) ? SEXP_HEADER(UNBOX(t), UNBOX(n)) : 0;
+}
+
+extern word Btag (void *d, word t, word n) {
     data *r;
 
     if (UNBOXED(d)) return BOX(0);
     else {
         r = TO_DATA(d);
 #ifndef DEBUG_PRINT
-        return BOX(TAG(r->tag) == SEXP_TAG && TO_SEXP(d)->tag == UNBOX(t) && LEN(r->tag) == UNBOX(n));
+        /* a sexp is packed exactly when its tag and arity fit */
+        if (SEXP_FITS(UNBOX(t), UNBOX(n))) return BOX(r->tag == SEXP_HEADER(UNBOX(t), UNBOX(n)));
+
+        return BOX(TAG(r->tag) == SEXP_TAG && !(r->tag & SEXP_PACKED) &&
+                   TO_SEXP(d)->tag == UNBOX(t) && LEN(r->tag) == UNBOX(n));
 #else
         return BOX(TAG(r->tag) == SEXP_TAG &&
                GET_SEXP_TAG(TO_SEXP(d)->tag) == UNBOX(t) && LEN(r->tag) == UNBOX(n));
@@ -1271,7 +1528,24 @@ extern int Btag (void *d, int t, int n) {
     }
 }
 
-extern int Barray_patt (void *d, int n) {
+/* Kind of a value as LkindOf gives it, plus the tag of a sexp and the length
+   of a sexp or an array, for pattern-match decision tables */
+extern int Bshape (void *d, int *tag, int *n) {
+    data *r;
+
+    *tag = 0;
+    *n = 0;
+    if (UNBOXED(d)) return UNBOXED_TAG;
+
+    r = TO_DATA(d);
+    *n = LEN(r->tag);
+    if (TAG(r->tag) == SEXP_TAG) {
+        *tag = SEXP_TAG_OF(d);
+    }
+    return TAG(r->tag);
+}
+
+extern word Barray_patt (void *d, word n) {
     data *r;
 
     if (UNBOXED(d)) return BOX(0);
@@ -1281,7 +1555,7 @@ extern int Barray_patt (void *d, int n) {
     }
 }
 
-extern int Bstring_patt (void *x, void *y) {
+extern word Bstring_patt (void *x, void *y) {
     data *rx = (data *) BOX (NULL),
             *ry = (data *) BOX (NULL);
 
@@ -1297,55 +1571,58 @@ extern int Bstring_patt (void *x, void *y) {
     }
 }
 
-extern int Bclosure_tag_patt (void *x) {
+extern word Bclosure_tag_patt (void *x) {
     if (UNBOXED(x)) return BOX(0);
 
     return BOX(TAG(TO_DATA(x)->tag) == CLOSURE_TAG);
 }
 
-extern int Bboxed_patt (void *x) {
+extern word Bboxed_patt (void *x) {
     return BOX(UNBOXED(x) ? 0 : 1);
 }
 
-extern int Bunboxed_patt (void *x) {
+extern word Bunboxed_patt (void *x) {
     return BOX(UNBOXED(x) ? 1 : 0);
 }
 
-extern int Barray_tag_patt (void *x) {
+extern word Barray_tag_patt (void *x) {
     if (UNBOXED(x)) return BOX(0);
 
     return BOX(TAG(TO_DATA(x)->tag) == ARRAY_TAG);
 }
 
-extern int Bstring_tag_patt (void *x) {
+extern word Bstring_tag_patt (void *x) {
     if (UNBOXED(x)) return BOX(0);
 
     return BOX(TAG(TO_DATA(x)->tag) == STRING_TAG);
 }
 
-extern int Bsexp_tag_patt (void *x) {
+extern word Bsexp_tag_patt (void *x) {
     if (UNBOXED(x)) return BOX(0);
 
     return BOX(TAG(TO_DATA(x)->tag) == SEXP_TAG);
 }
 
-extern void* Bsta (void *v, int i, void *x) {
+extern void* Bsta (void *v, word i, void *x) {
     if (UNBOXED(i)) {
         ASSERT_BOXED(".sta:3", x);
         //    ASSERT_UNBOXED(".sta:2", i);
 
         if (TAG(TO_DATA(x)->tag) == STRING_TAG)((char*) x)[UNBOX(i)] = (char) UNBOX(v);
-        else ((int*) x)[UNBOX(i)] = (int) v;
+        else ((word*) x)[UNBOX(i)] = COMPRESS(v);
 
         return v;
     }
 
-    * (void**) i = v;
+    * (word*) DECOMPRESS(i) = COMPRESS(v);
 
     return v;
 }
 
+/* Unboxes the arguments in place; only the i386 va_list is a plain pointer
+   to the arguments, elsewhere they are left as they are */
 static void fix_unboxed (char *s, va_list va) {
+#if defined(__i386__)
     size_t *p = (size_t*)va;
     int i = 0;
 
@@ -1359,6 +1636,7 @@ static void fix_unboxed (char *s, va_list va) {
         }
         s++;
     }
+#endif
 }
 
 extern void Lfailure (char *s, ...) {
@@ -1369,11 +1647,11 @@ extern void Lfailure (char *s, ...) {
     vfailure    (s, args);
 }
 
-extern void Bmatch_failure (void *v, char *fname, int line, int col) {
+extern void Bmatch_failure (void *v, char *fname, word line, word col) {
     createStringBuf ();
     printValue (v);
     failure ("match failure at %s:%d:%d, value '%s'\n",
-             fname, UNBOX(line), UNBOX(col), stringBuf.contents);
+             fname, (int) UNBOX(line), (int) UNBOX(col), stringBuf.contents);
 }
 
 extern void* /*Lstrcat*/ Li__Infix_4343 (void *a, void *b) {
@@ -1391,7 +1669,7 @@ extern void* /*Lstrcat*/ Li__Infix_4343 (void *a, void *b) {
 
     push_extra_root (&a);
     push_extra_root (&b);
-    d  = (data *) alloc (sizeof(int) + LEN(da->tag) + LEN(db->tag) + 1);
+    d  = (data *) alloc (sizeof(word) + LEN(da->tag) + LEN(db->tag) + 1);
     pop_extra_root (&b);
     pop_extra_root (&a);
 
@@ -1452,12 +1730,12 @@ extern void* LgetEnv (char *var) {
     return s;
 }
 
-extern int Lsystem (char *cmd) {
+extern word Lsystem (char *cmd) {
     return BOX (system (cmd));
 }
 
 extern void Lfprintf (FILE *f, char *s, ...) {
-    va_list args = (va_list) BOX (NULL);
+    va_list args;
 
     ASSERT_BOXED("fprintf:1", f);
     ASSERT_STRING("fprintf:2", s);
@@ -1471,18 +1749,18 @@ extern void Lfprintf (FILE *f, char *s, ...) {
 }
 
 extern void Lprintf (char *s, ...) {
-    va_list args = (va_list) BOX (NULL);
+    va_list args;
 
     ASSERT_STRING("printf:1", s);
 
     va_start    (args, s);
     fix_unboxed (s, args);
 
-    if (vprintf (s, args) < 0) {
+    if (vfprintf (runtime_out, s, args) < 0) {
         failure ("fprintf (...): %s\n", strerror (errno));
     }
 
-    fflush (stdout);
+    fflush (runtime_out);
 }
 
 extern FILE* Lfopen (char *f, char *m) {
@@ -1508,10 +1786,10 @@ extern void Lfclose (FILE *f) {
 extern void* LreadLine () {
     char *buf;
 
-    if (scanf ("%m[^\n]", &buf) == 1) {
+    if (fscanf (runtime_in, "%m[^\n]", &buf) == 1) {
         void * s = Bstring (buf);
 
-        getchar ();
+        fgetc (runtime_in);
 
         free (buf);
         return s;
@@ -1595,35 +1873,35 @@ extern void* Ltl (void *v) {
 }
 
 /* Lread is an implementation of the "read" construct */
-extern int Lread () {
-    int result = BOX(0);
+extern word Lread () {
+    int result = 0;
 
-    printf ("> ");
-    fflush (stdout);
-    int err = scanf  ("%d", &result);
+    fprintf (runtime_out, "> ");
+    fflush  (runtime_out);
+    int err = fscanf (runtime_in, "%d", &result);
 
     return BOX(result);
 }
 
 /* Lwrite is an implementation of the "write" construct */
-extern int Lwrite (int n) {
-    printf ("%d\n", UNBOX(n));
-    fflush (stdout);
+extern word Lwrite (word n) {
+    fprintf (runtime_out, "%ld\n", (long) UNBOX(n));
+    fflush  (runtime_out);
 
     return 0;
 }
 
-extern int Lrandom (int n) {
+extern word Lrandom (word n) {
     ASSERT_UNBOXED("Lrandom, 0", n);
 
     if (UNBOX(n) <= 0) {
-        failure ("invalid range in random: %d\n", UNBOX(n));
+        failure ("invalid range in random: %ld\n", (long) UNBOX(n));
     }
 
     return BOX (random () % UNBOX(n));
 }
 
-extern int Ltime () {
+extern word Ltime () {
     struct timespec t;
 
     clock_gettime (CLOCK_MONOTONIC_RAW, &t);
@@ -1633,7 +1911,8 @@ extern int Ltime () {
 
 extern void set_args (int argc, char *argv[]) {
     data *a;
-    int n = argc, *p = NULL;
+    int n = argc;
+    word *p = NULL;
     int i;
 
     __pre_gc ();
@@ -1654,7 +1933,7 @@ extern void set_args (int argc, char *argv[]) {
         print_indent ();
     printf ("set_args: iteration %i %p %p ->\n", i, &p, p); fflush(stdout);
 #endif
-        ((int*)p) [i] = (int) Bstring (argv[i]);
+        p[i] = COMPRESS(Bstring (argv[i]));
 #ifdef DEBUG_PRINT
         print_indent ();
     printf ("set_args: iteration %i <- %p %p\n", i, &p, p); fflush(stdout);
@@ -1675,7 +1954,7 @@ extern void set_args (int argc, char *argv[]) {
 
 /* GC starts here */
 
-static int enable_GC = 1;
+static __thread int enable_GC = 1;
 
 extern void LenableGC () {
     enable_GC = 1;
@@ -1685,7 +1964,8 @@ extern void LdisableGC () {
     enable_GC = 0;
 }
 
-extern const size_t __start_custom_data, __stop_custom_data;
+/* The global area of the running bytecode, set by the interpreter */
+extern __thread void *__start_custom_data, *__stop_custom_data;
 
 # ifdef __ENABLE_GC__
 
@@ -1705,25 +1985,40 @@ extern void __gc_root_scan_stack ();
 /* ======================================== */
 
 //static size_t SPACE_SIZE = 16;
-static size_t SPACE_SIZE = 256 * 1024 * 1024;
+# ifndef COMPRESSED_REFS
+# define INITIAL_SPACE_SIZE (256 * 1024 * 1024)
+# else
+# define INITIAL_SPACE_SIZE (64 * 1024 * 1024)  // both spaces have to fit into the low 2GB
+# endif
+static __thread size_t SPACE_SIZE = INITIAL_SPACE_SIZE;
 // static size_t SPACE_SIZE = 128;
 // static size_t SPACE_SIZE = 1024 * 1024;
 
+/* A space mapped from a snapshot by __heap_map; its pages are backed by the
+   file, so it is not kept for reuse (see runtime_cache_regions) */
+static __thread word *mapped_space;
+
 static int free_pool (pool * p) {
-    size_t *a = p->begin, b = p->size;
+    word   *a = p->begin;
+    size_t  b = p->size;
     p->begin   = NULL;
     p->size    = 0;
     p->end     = NULL;
     p->current = NULL;
-    return munmap((void *)a, b);
+    if (a == mapped_space) {
+        mapped_space = NULL;
+        munmap (a, b * sizeof(word));
+        return 0;
+    }
+    release_region (a, b * sizeof(word), 0);
+    return 0;
 }
 
 static void init_to_space (int flag) {
     size_t space_size = 0;
     if (flag) SPACE_SIZE = SPACE_SIZE << 1;
-    space_size     = SPACE_SIZE * sizeof(size_t);
-    to_space.begin = mmap (NULL, space_size, PROT_READ | PROT_WRITE,
-                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+    space_size     = SPACE_SIZE * sizeof(word);
+    to_space.begin = reserve_region (space_size, 0);
     if (to_space.begin == MAP_FAILED) {
         perror ("EROOR: init_to_space: mmap failed\n");
         exit   (1);
@@ -1768,9 +2063,9 @@ int is_valid_heap_pointer (void *p)  {
     return IS_VALID_HEAP_POINTER(p);
 }
 
-extern size_t * gc_copy (size_t *obj);
+extern word * gc_copy (word *obj);
 
-static void copy_elements (size_t *where, size_t *from, int len) {
+static void copy_elements (word *where, word *from, int len) {
     int    i = 0;
     void * p = NULL;
 #ifdef DEBUG_PRINT
@@ -1778,7 +2073,7 @@ static void copy_elements (size_t *where, size_t *from, int len) {
   printf ("copy_elements: start; len = %d\n", len); fflush (stdout);
 #endif
     for (i = 0; i < len; i++) {
-        size_t elem = from[i];
+        word elem = from[i];
         if (!IS_VALID_HEAP_POINTER(elem)) {
             *where = elem;
             where++;
@@ -1793,8 +2088,8 @@ static void copy_elements (size_t *where, size_t *from, int len) {
       printf ("copy_elements: fix element: %p -> %p\n", elem, *where);
       fflush (stdout);
 #endif
-            p = gc_copy ((size_t*) elem);
-            *where = (size_t) p;
+            p = gc_copy ((word*) DECOMPRESS(elem));
+            *where = COMPRESS(p);
             where ++;
         }
 #ifdef DEBUG_PRINT
@@ -1812,10 +2107,39 @@ static void copy_elements (size_t *where, size_t *from, int len) {
 
 }
 
+/* Copies a list starting at the cons cell obj, which has not been copied yet.
+   The heads are copied recursively, but the tails are followed in a loop, so
+   a long list does not take a recursion as deep as its length */
+static word * gc_copy_list (word *obj) {
+    data *d      = TO_DATA(obj);
+    word *copy   = current + 1;
+    word *result = copy;
+    word  tail;
+
+    while (1) {
+        current += 3;
+        copy[-1] = d->tag;
+        d->tag   = COMPRESS(copy);
+
+        copy_elements (copy, obj, 1);
+
+        tail = obj[1];
+        if (!IS_VALID_HEAP_POINTER(tail) || TO_DATA(DECOMPRESS(tail))->tag != CONS_HEADER) {
+            copy_elements (copy + 1, obj + 1, 1);
+            return result;
+        }
+        /* the next cell goes right after everything its head has taken */
+        obj  = (word*) DECOMPRESS(tail);
+        d    = TO_DATA(obj);
+        copy[1] = COMPRESS(current + 1);
+        copy    = current + 1;
+    }
+}
+
 static int extend_spaces (void) {
     void *p = (void *) BOX (NULL);
-    size_t old_space_size = SPACE_SIZE        * sizeof(size_t),
-            new_space_size = (SPACE_SIZE << 1) * sizeof(size_t);
+    size_t old_space_size = SPACE_SIZE        * sizeof(word),
+            new_space_size = (SPACE_SIZE << 1) * sizeof(word);
     p = mremap(to_space.begin, old_space_size, new_space_size, 0);
 #ifdef DEBUG_PRINT
     indent++; print_indent ();
@@ -1839,10 +2163,10 @@ static int extend_spaces (void) {
     return 0;
 }
 
-extern size_t * gc_copy (size_t *obj) {
+extern word * gc_copy (word *obj) {
     data   *d    = TO_DATA(obj);
     sexp   *s    = NULL;
-    size_t *copy = NULL;
+    word   *copy = NULL;
     int     i    = 0;
 #ifdef DEBUG_PRINT
     int len1, len2, len3;
@@ -1876,11 +2200,18 @@ extern size_t * gc_copy (size_t *obj) {
     if (IS_FORWARD_PTR(d->tag)) {
 #ifdef DEBUG_PRINT
         print_indent ();
-    printf ("gc_copy: IS_FORWARD_PTR: return! %p -> %p\n", obj, (size_t *) d->tag);
+    printf ("gc_copy: IS_FORWARD_PTR: return! %p -> %p\n", obj, (word *) DECOMPRESS(d->tag));
     fflush(stdout);
     indent--;
 #endif
-        return (size_t *) d->tag;
+        return (word *) DECOMPRESS(d->tag);
+    }
+
+    if (CONS_HEADER != 0 && d->tag == CONS_HEADER) {
+#ifdef DEBUG_PRINT
+        indent--;
+#endif
+        return gc_copy_list (obj);
     }
 
     copy = current;
@@ -1899,7 +2230,7 @@ extern size_t * gc_copy (size_t *obj) {
             current += i+1;
             *copy = d->tag;
             copy++;
-            d->tag = (int) copy;
+            d->tag = COMPRESS(copy);
             copy_elements (copy, obj, i);
             break;
 
@@ -1908,11 +2239,11 @@ extern size_t * gc_copy (size_t *obj) {
             print_indent ();
       printf ("gc_copy:array_tag; len =  %zu\n", LEN(d->tag)); fflush (stdout);
 #endif
-            current += ((LEN(d->tag) + 1) * sizeof (int) - 1) / sizeof (size_t) + 1;
+            current += LEN(d->tag) + 1;
             *copy = d->tag;
             copy++;
             i = LEN(d->tag);
-            d->tag = (int) copy;
+            d->tag = COMPRESS(copy);
             copy_elements (copy, obj, i);
             break;
 
@@ -1921,10 +2252,10 @@ extern size_t * gc_copy (size_t *obj) {
             print_indent ();
       printf ("gc_copy:string_tag; len = %d\n", LEN(d->tag) + 1); fflush (stdout);
 #endif
-            current += (LEN(d->tag) + sizeof(int)) / sizeof(size_t) + 1;
+            current += (LEN(d->tag) + sizeof(word)) / sizeof(word) + 1;
             *copy = d->tag;
             copy++;
-            d->tag = (int) copy;
+            d->tag = COMPRESS(copy);
             strcpy ((char*)&copy[0], (char*) obj);
             break;
 
@@ -1940,13 +2271,15 @@ extern size_t * gc_copy (size_t *obj) {
 	      len1, len2, len3);
       fflush (stdout);
 #endif
-            i = LEN(s->contents.tag);
-            current += i + 2;
-            *copy = s->tag;
-            copy++;
+            i = LEN(d->tag);
+            current += i + SEXP_HEADER_WORDS(d->tag);
+            if (!(d->tag & SEXP_PACKED)) {
+                *copy = s->tag;
+                copy++;
+            }
             *copy = d->tag;
             copy++;
-            d->tag = (int) copy;
+            d->tag = COMPRESS(copy);
             copy_elements (copy, obj, i);
             break;
 
@@ -1970,7 +2303,8 @@ extern size_t * gc_copy (size_t *obj) {
     return copy;
 }
 
-extern void gc_test_and_copy_root (size_t ** root) {
+/* A root held in a C variable, see push_extra_root */
+extern void gc_test_and_copy_root (word ** root) {
 #ifdef DEBUG_PRINT
     indent++;
 #endif
@@ -1992,10 +2326,17 @@ extern void gc_test_and_copy_root (size_t ** root) {
 #endif
 }
 
+/* A root held in a slot of the stack or of the global area */
+extern void gc_test_and_copy_slot (word *slot) {
+    if (IS_VALID_HEAP_POINTER(*slot)) {
+        *slot = COMPRESS(gc_copy ((word*) DECOMPRESS(*slot)));
+    }
+}
+
 extern void gc_root_scan_data (void) {
-    size_t * p = (size_t*)&__start_custom_data;
-    while  (p < (size_t*)&__stop_custom_data) {
-        gc_test_and_copy_root ((size_t**)p);
+    word * p = (word*)__start_custom_data;
+    while  (p < (word*)__stop_custom_data) {
+        gc_test_and_copy_slot (p);
         p++;
     }
 }
@@ -2005,12 +2346,11 @@ static inline void init_extra_roots (void) {
 }
 
 extern void __init (void) {
-    size_t space_size = SPACE_SIZE * sizeof(size_t);
+    size_t space_size = SPACE_SIZE * sizeof(word);
 
     srandom (time (NULL));
 
-    from_space.begin = mmap (NULL, space_size, PROT_READ | PROT_WRITE,
-                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+    from_space.begin = reserve_region (space_size, 0);
     to_space.begin   = NULL;
     if (from_space.begin == MAP_FAILED) {
         perror ("EROOR: init_pool: mmap failed\n");
@@ -2025,6 +2365,138 @@ extern void __init (void) {
     init_extra_roots ();
 }
 
+/* Releases the heap */
+extern void __shutdown (void) {
+    free_pool (&from_space);
+    if (to_space.begin != NULL) free_pool (&to_space);
+}
+
+static void* gc (size_t size);
+
+/* Collects the garbage, so that the heap holds only live objects */
+extern void __heap_collect (void) {
+    init_to_space (0);
+    gc (0);
+}
+
+/* The used part of the heap is [begin, begin + *used), in a space of *size words */
+extern word *__heap_used (size_t *used, size_t *size) {
+    *used = from_space.current - from_space.begin;
+    *size = from_space.size;
+    return from_space.begin;
+}
+
+/* Replaces the heap by a space of size words at begin, the first used words
+   of which are mapped privately from fd at offset (a multiple of the page
+   size). The space is mapped over whatever is at begin, so the caller has to
+   reserve the range beforehand */
+extern int __heap_map (word *begin, size_t size, size_t used, int fd, off_t offset) {
+    char *p;
+
+    free_pool (&from_space);
+    p = mmap (begin, size * sizeof(word), PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+    if (p == MAP_FAILED) return -1;
+    if (used > 0 && mmap (p, used * sizeof(word), PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_FIXED, fd, offset) == MAP_FAILED) {
+        munmap (p, size * sizeof(word));
+        return -1;
+    }
+
+    mapped_space       = begin;
+    from_space.begin   = begin;
+    from_space.current = begin + used;
+    from_space.end     = begin + size;
+    from_space.size    = size;
+    SPACE_SIZE         = size;
+    return 0;
+}
+
+/* A copy of the thread-local state of the runtime */
+struct runtime_context {
+    pool              from_space;
+    pool              to_space;
+    word             *current;
+    word             *mapped_space;
+    extra_roots_pool  extra_roots;
+    StringBuf         string_buf;
+    int               enable_gc;
+    size_t            space_size;
+    size_t            stack_top, stack_bottom;
+    void             *start_custom_data, *stop_custom_data;
+    void             *sysargs;
+    int               checks;
+    FILE             *in, *out;
+    void            (*on_failure) (const char *message);
+};
+
+/* The context entered on the current thread, if any */
+static __thread runtime_context *entered;
+
+extern runtime_context *runtime_context_create (FILE *in, FILE *out, int checks,
+                                                void (*on_failure) (const char *message)) {
+    runtime_context *c = (runtime_context*) calloc (1, sizeof (runtime_context));
+
+    if (c == NULL) {
+        failure ("runtime_context_create: unable to allocate memory\n");
+    }
+    c->enable_gc  = 1;
+    c->space_size = INITIAL_SPACE_SIZE;
+    c->checks     = checks;
+    c->in         = in;
+    c->out        = out;
+    c->on_failure = on_failure;
+    return c;
+}
+
+extern void runtime_context_enter (runtime_context *c) {
+    if (entered != NULL) {
+        failure ("runtime_context_enter: the thread runs another machine\n");
+    }
+    entered             = c;
+    from_space          = c->from_space;
+    to_space            = c->to_space;
+    current             = c->current;
+    mapped_space        = c->mapped_space;
+    extra_roots         = c->extra_roots;
+    stringBuf           = c->string_buf;
+    enable_GC           = c->enable_gc;
+    SPACE_SIZE          = c->space_size;
+    __gc_stack_top      = c->stack_top;
+    __gc_stack_bottom   = c->stack_bottom;
+    __start_custom_data = c->start_custom_data;
+    __stop_custom_data  = c->stop_custom_data;
+    global_sysargs      = c->sysargs;
+    runtime_checks      = c->checks;
+    runtime_in          = c->in;
+    runtime_out         = c->out;
+    failure_handler     = c->on_failure;
+}
+
+extern void runtime_context_leave (runtime_context *c) {
+    c->from_space        = from_space;
+    c->to_space          = to_space;
+    c->current           = current;
+    c->mapped_space      = mapped_space;
+    c->extra_roots       = extra_roots;
+    c->string_buf        = stringBuf;
+    c->enable_gc         = enable_GC;
+    c->space_size        = SPACE_SIZE;
+    c->stack_top         = __gc_stack_top;
+    c->stack_bottom      = __gc_stack_bottom;
+    c->start_custom_data = __start_custom_data;
+    c->stop_custom_data  = __stop_custom_data;
+    c->sysargs           = global_sysargs;
+    c->checks            = runtime_checks;
+    /* failures outside of any machine end the process again */
+    failure_handler      = NULL;
+    entered              = NULL;
+}
+
+extern void runtime_context_destroy (runtime_context *c) {
+    free (c);
+}
+
 static void* gc (size_t size) {
     if (! enable_GC) {
         Lfailure ("GC disabled");
@@ -2049,10 +2521,10 @@ static void* gc (size_t size) {
 #ifdef DEBUG_PRINT
         print_indent ();
     printf ("gc: extra_root № %i: %p %p\n", i, extra_roots.roots[i],
-	    (size_t*) extra_roots.roots[i]);
+	    (word*) extra_roots.roots[i]);
     fflush (stdout);
 #endif
-        gc_test_and_copy_root ((size_t**)extra_roots.roots[i]);
+        gc_test_and_copy_root ((word**)extra_roots.roots[i]);
     }
 #ifdef DEBUG_PRINT
     print_indent ();
@@ -2102,7 +2574,7 @@ static void* gc (size_t size) {
 
 #ifdef DEBUG_PRINT
 static void printFromSpace (void) {
-  size_t * cur = from_space.begin, *tmp = NULL;
+  word   * cur = from_space.begin, *tmp = NULL;
   data   * d   = NULL;
   sexp   * s   = NULL;
   size_t   len = 0;
@@ -2119,16 +2591,16 @@ static void printFromSpace (void) {
     case STRING_TAG:
       printf ("(=>%p): STRING\n\t%s; len = %i %zu\n",
 	      d->contents, d->contents,
-	      LEN(d->tag), LEN(d->tag) + 1 + sizeof(int));
+	      LEN(d->tag), LEN(d->tag) + 1 + sizeof(word));
       fflush (stdout);
-      len = (LEN(d->tag) + sizeof(int)) / sizeof(size_t) + 1;
+      len = (LEN(d->tag) + sizeof(word)) / sizeof(word) + 1;
       break;
 
     case CLOSURE_TAG:
       printf ("(=>%p): CLOSURE\n\t", d->contents);
       len = LEN(d->tag);
       for (int i = 0; i < len; i++) {
-	int elem = ((int*)d->contents)[i];
+	int elem = ((word*)d->contents)[i];
 	if (UNBOXED(elem)) printf ("%d ", elem);
 	else printf ("%p ", elem);
       }
@@ -2141,7 +2613,7 @@ static void printFromSpace (void) {
       printf ("(=>%p): ARRAY\n\t", d->contents);
       len = LEN(d->tag);
       for (int i = 0; i < len; i++) {
-	int elem = ((int*)d->contents)[i];
+	int elem = ((word*)d->contents)[i];
 	if (UNBOXED(elem)) printf ("%d ", elem);
 	else printf ("%p ", elem);
       }
@@ -2158,7 +2630,7 @@ static void printFromSpace (void) {
       len = LEN(d->tag);
       tmp = (s->contents.contents);
       for (int i = 0; i < len; i++) {
-	int elem = ((int*)tmp)[i];
+	word elem = ((word*)tmp)[i];
 	if (UNBOXED(elem)) printf ("%d ", UNBOX(elem));
 	else printf ("%p ", elem);
       }
@@ -2192,7 +2664,7 @@ static void printFromSpace (void) {
 // alloc: allocates `size` bytes in heap
 extern void * alloc (size_t size) {
     void * p = (void*)BOX(NULL);
-    size = (size - 1) / sizeof(size_t) + 1; // convert bytes to words
+    size = (size - 1) / sizeof(word) + 1; // convert bytes to words
 #ifdef DEBUG_PRINT
     indent++; print_indent ();
   printf ("alloc: current: %p %zu words!", from_space.current, size);
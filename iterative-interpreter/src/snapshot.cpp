@@ -0,0 +1,191 @@
+#include "snapshot.h"
+#include "stack.h"
+#include <cstring>
+#include <utility>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+extern "C" {
+extern void __heap_collect(void);
+extern word *__heap_used(size_t *used, size_t *size);
+extern int __heap_map(word *begin, size_t size, size_t used, int fd, off_t offset);
+}
+
+namespace snapshot {
+
+    namespace {
+        const char MAGIC[8] = {'L', 'A', 'M', 'A', 'S', 'N', 'A', 'P'};
+
+        // Addresses are those of the run the snapshot was taken in
+        struct header {
+            char magic[8];
+            uint32_t word_size;
+            uint32_t pointer_size;   // tells the compressed build from the 32-bit one
+            uint64_t bytecode_size;
+            uint64_t bytecode_hash;
+            uint64_t bytecode;       // the mapping of the file
+            uint64_t ip;             // offset in the code
+            uint64_t fp;
+            uint64_t globals;
+            uint64_t global_words;
+            uint64_t stack_bottom;
+            uint64_t stack_words;
+            uint64_t heap;
+            uint64_t heap_words;     // size of the space
+            uint64_t heap_used;
+            uint64_t heap_offset;    // in the file, page aligned
+        };
+
+        uint64_t address(const void *p) {
+            return reinterpret_cast<uintptr_t>(p);
+        }
+
+        template<typename T>
+        T *pointer(uint64_t a) {
+            return reinterpret_cast<T *>(static_cast<uintptr_t>(a));
+        }
+
+        // A word of the saved stack pointing into the saved stack or global
+        // area points to the same place of the new ones; boxed integers, return
+        // addresses and heap references are left as they are
+        word relocate(word value, const header &h, word *bottom, word *globals) {
+            if (boxing::is_boxed(value)) {
+                return value;
+            }
+            uint64_t v = address(boxing::decompress(value));
+            uint64_t stack_top = h.stack_bottom - h.stack_words * sizeof(word);
+            if (stack_top <= v && v <= h.stack_bottom) {
+                return boxing::compress(bottom - (h.stack_bottom - v) / sizeof(word));
+            }
+            if (h.globals <= v && v < h.globals + h.global_words * sizeof(word)) {
+                return boxing::compress(globals + (v - h.globals) / sizeof(word));
+            }
+            return value;
+        }
+    }
+
+    void write(const char *name, bytefile *bf, position at) {
+        __heap_collect();
+        size_t used, size;
+        word *heap = __heap_used(&used, &size);
+        word *top = stack::get_stack_top(), *bottom = stack::get_stack_bottom();
+        size_t page = sysconf(_SC_PAGESIZE);
+
+        header h = {};
+        memcpy(h.magic, MAGIC, sizeof(MAGIC));
+        h.word_size = sizeof(word);
+        h.pointer_size = sizeof(void *);
+        h.bytecode_size = bf->file_size;
+        h.bytecode_hash = file_hash(bf);
+        h.bytecode = address(bf->file_ptr);
+        h.ip = at.ip - bf->code_ptr;
+        h.fp = address(at.fp);
+        h.globals = address(bf->global_ptr);
+        h.global_words = bf->global_area_size;
+        h.stack_bottom = address(bottom);
+        h.stack_words = bottom - top;
+        h.heap = address(heap);
+        h.heap_words = size;
+        h.heap_used = used;
+        h.heap_offset = (sizeof(h) + (h.global_words + h.stack_words) * sizeof(word) + page - 1) / page * page;
+
+        FILE *f = fopen(name, "wb");
+        if (f == nullptr) {
+            failure("cannot open %s for writing\n", name);
+        }
+        fwrite(&h, sizeof(h), 1, f);
+        fwrite(bf->global_ptr, sizeof(word), h.global_words, f);
+        fwrite(top, sizeof(word), h.stack_words, f);
+        fseek(f, h.heap_offset, SEEK_SET);
+        fwrite(heap, sizeof(word), used, f);
+        if (ferror(f) | fclose(f)) {
+            failure("%s: unable to write the snapshot\n", name);
+        }
+    }
+
+    reservation reserve(const char *name) {
+        int fd = open(name, O_RDONLY);
+        if (fd == -1) {
+            failure("%s: %s\n", name, strerror(errno));
+        }
+        header h;
+        if (pread(fd, &h, sizeof(h), 0) != (ssize_t) sizeof(h) || memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0) {
+            failure("%s: not a snapshot\n", name);
+        }
+        close(fd);
+        if (h.word_size != sizeof(word) || h.pointer_size != sizeof(void *)) {
+            failure("%s: the snapshot is taken by another build of the interpreter\n", name);
+        }
+
+        reservation ranges = {pointer<char>(h.bytecode), (size_t) h.bytecode_size,
+                              pointer<word>(h.heap), (size_t) h.heap_words * sizeof(word)};
+        for (auto range: {std::make_pair((char *) ranges.bytecode, ranges.bytecode_size),
+                          std::make_pair((char *) ranges.heap, ranges.heap_size)}) {
+            void *p = mmap(range.first, range.second, PROT_NONE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE, -1, 0);
+            // kernels before 4.17 take the address as a hint
+            if (p != MAP_FAILED && p != range.first) {
+                munmap(p, range.second);
+            }
+            if (p != range.first) {
+                failure("%s: the addresses of the snapshot are taken in this process\n", name);
+            }
+        }
+        return ranges;
+    }
+
+    position read(const char *name, const reservation &ranges, bytefile *bf) {
+        int fd = open(name, O_RDONLY);
+        struct stat st;
+        if (fd == -1 || fstat(fd, &st) == -1) {
+            failure("%s: %s\n", name, strerror(errno));
+        }
+        if ((size_t) st.st_size < sizeof(header)) {
+            failure("%s: not a snapshot\n", name);
+        }
+        auto image = reinterpret_cast<char *>(mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0));
+        if (image == MAP_FAILED) {
+            failure("%s: %s\n", name, strerror(errno));
+        }
+
+        header h;
+        memcpy(&h, image, sizeof(h));
+        if (memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0
+            || (h.heap_used > 0 && h.heap_offset + h.heap_used * sizeof(word) > (uint64_t) st.st_size)
+            || (sizeof(h) + (h.global_words + h.stack_words) * sizeof(word)) > h.heap_offset
+            || h.heap_used > h.heap_words) {
+            failure("%s: not a snapshot\n", name);
+        }
+        if (ranges.bytecode != pointer<char>(h.bytecode) || ranges.heap != pointer<word>(h.heap)
+            || ranges.heap_size != h.heap_words * sizeof(word)) {
+            failure("%s: the snapshot has changed since its addresses were reserved\n", name);
+        }
+        if (h.bytecode_size != bf->file_size || h.bytecode_hash != file_hash(bf)) {
+            failure("%s: the snapshot is taken of another bytecode file\n", name);
+        }
+        if (h.global_words != (uint64_t) bf->global_area_size || h.stack_words > (uint64_t) STACK_CAPACITY
+            || h.ip >= (uint64_t) (bf->file_ptr + bf->file_size - bf->code_ptr)) {
+            failure("%s: the snapshot does not fit the bytecode\n", name);
+        }
+
+        // the heap refers to itself and to the code (closures) by address
+        if (__heap_map(ranges.heap, h.heap_words, h.heap_used, fd, h.heap_offset) == -1
+            || move_file(bf, ranges.bytecode) == -1) {
+            failure("%s: %s\n", name, strerror(errno));
+        }
+        close(fd);
+
+        auto saved = reinterpret_cast<word *>(image + sizeof(h));
+        memcpy(bf->global_ptr, saved, h.global_words * sizeof(word));
+        word *bottom = stack::get_stack_bottom(), *top = bottom - h.stack_words;
+        memcpy(top, saved + h.global_words, h.stack_words * sizeof(word));
+        stack::set_stack_top(top);
+        for (word *p = top; p < bottom; p++) {
+            *p = relocate(*p, h, bottom, bf->global_ptr);
+        }
+        munmap(image, st.st_size);
+
+        word fp = relocate(boxing::compress(pointer<word>(h.fp)), h, bottom, bf->global_ptr);
+        return {bf->code_ptr + h.ip, boxing::decompress<word>(fp)};
+    }
+}
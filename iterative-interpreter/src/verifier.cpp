@@ -0,0 +1,469 @@
+#include "verifier.h"
+#include "opcodes.h"
+#include <string>
+#include <vector>
+
+namespace verifier {
+
+    struct jump {
+        int32_t from;
+        int32_t to;
+        bool call;
+    };
+
+    class bytecode_verifier {
+    public:
+        explicit bytecode_verifier(bytefile *file) : bf(file), code_size(0) {}
+
+        stack_map verify();
+
+    private:
+        bytefile *bf;
+        int32_t code_size;
+
+        std::vector<int32_t> index;
+        std::vector<int32_t> functions;
+        std::vector<jump> jumps;
+
+        // per instruction: abstract operand stack before it and the function it was reached from
+        std::vector<std::string> states;
+        std::vector<bool> visited;
+        std::vector<int32_t> owner;
+
+        void error(int32_t offset, const char *message);
+
+        char *at(int32_t offset);
+
+        int32_t read_int(int32_t &offset);
+
+        void check_string(int32_t offset, int32_t pos);
+
+        void check_location(int32_t offset, char l, int32_t i, int32_t argc, int32_t nlocals);
+
+        int32_t decode(int32_t offset);
+
+        void verify_function(int32_t begin);
+
+        std::vector<bool> find_tail_calls();
+
+        void flow(int32_t function, int32_t from, int32_t to, const std::string &state,
+                  std::vector<int32_t> &work);
+    };
+
+    void bytecode_verifier::error(int32_t offset, const char *message) {
+        failure("VERIFIER: %s at 0x%.8x\n", message, offset);
+    }
+
+    char *bytecode_verifier::at(int32_t offset) {
+        return bf->code_ptr + offset;
+    }
+
+    int32_t bytecode_verifier::read_int(int32_t &offset) {
+        if (offset + (int32_t) sizeof(int32_t) > code_size) {
+            error(offset, "truncated instruction");
+        }
+        int32_t value = *reinterpret_cast<int32_t *>(at(offset));
+        offset += sizeof(int32_t);
+        return value;
+    }
+
+    void bytecode_verifier::check_string(int32_t offset, int32_t pos) {
+        if (pos < 0 || pos >= bf->stringtab_size) {
+            error(offset, "string index out of range");
+        }
+    }
+
+    void bytecode_verifier::check_location(int32_t offset, char l, int32_t i, int32_t argc, int32_t nlocals) {
+        if (i < 0) {
+            error(offset, "negative variable index");
+        }
+        switch (l) {
+            case GLOBAL:
+                if (i >= bf->global_area_size) error(offset, "global index out of range");
+                break;
+            case LOCAL:
+                if (nlocals >= 0 && i >= nlocals) error(offset, "local index out of range");
+                break;
+            case ARGS:
+                if (argc >= 0 && i >= argc) error(offset, "argument index out of range");
+                break;
+            case BINDED:
+                break;
+            default:
+                error(offset, "invalid variable location");
+        }
+    }
+
+    // Checks the instruction at offset in isolation and returns the offset of the next one
+    int32_t bytecode_verifier::decode(int32_t offset) {
+        int32_t start = offset;
+        char x = *at(offset++),
+                h = (x & 0xF0) >> 4,
+                l = x & 0x0F;
+        int32_t n;
+
+        switch (h) {
+            case BINOP:
+                if (l < BINOP_ADD || l > BINOP_OR) error(start, "invalid binary operator");
+                break;
+
+            case BLOCK_DATE:
+                switch (x) {
+                    case BLOCK_CONST:
+                        read_int(offset);
+                        break;
+                    case BLOCK_STRING:
+                        check_string(start, read_int(offset));
+                        break;
+                    case BLOCK_SEXP:
+                        check_string(start, read_int(offset));
+                        if (read_int(offset) < 0) error(start, "negative sexp arity");
+                        break;
+                    case BLOCK_JMP:
+                        jumps.push_back({start, read_int(offset), false});
+                        break;
+                    case BLOCK_STA:
+                    case BLOCK_END:
+                    case BLOCK_DROP:
+                    case BLOCK_DUP:
+                    case BLOCK_SWAP:
+                    case BLOCK_ELEM:
+                        break;
+                    default:
+                        error(start, "invalid opcode");
+                }
+                break;
+
+            case LD:
+            case LDA:
+            case ST:
+                n = read_int(offset);
+                check_location(start, l, n, -1, -1);
+                break;
+
+            case BLOCK_MOVE:
+                switch (x) {
+                    case CJMPZ:
+                    case CJMPNZ:
+                        jumps.push_back({start, read_int(offset), false});
+                        break;
+                    case BEGIN:
+                    case CBEGIN:
+                        functions.push_back(start);
+                        if (read_int(offset) < 0 || read_int(offset) < 0) error(start, "negative frame size");
+                        break;
+                    case CLOSUSRE:
+                        jumps.push_back({start, read_int(offset), true});
+                        n = read_int(offset);
+                        if (n < 0) error(start, "negative closure size");
+                        for (int32_t i = 0; i < n; i++) {
+                            if (offset >= code_size) error(start, "truncated instruction");
+                            char loc = *at(offset++);
+                            check_location(start, loc, read_int(offset), -1, -1);
+                        }
+                        break;
+                    case CALLC:
+                        if (read_int(offset) < 0) error(start, "negative argument count");
+                        break;
+                    case CALL:
+                        jumps.push_back({start, read_int(offset), true});
+                        if (read_int(offset) < 0) error(start, "negative argument count");
+                        break;
+                    case PLACE_TAG:
+                        check_string(start, read_int(offset));
+                        if (read_int(offset) < 0) error(start, "negative sexp arity");
+                        break;
+                    case ARRAY:
+                        if (read_int(offset) < 0) error(start, "negative array size");
+                        break;
+                    case CALL_FAIL:
+                        read_int(offset);
+                        read_int(offset);
+                        break;
+                    case LINE:
+                        read_int(offset);
+                        break;
+                    default:
+                        error(start, "invalid opcode");
+                }
+                break;
+
+            case PATT:
+                if (x < PATT_BSTRING || x > PATT_BCLOSURE_T) error(start, "invalid pattern");
+                break;
+
+            case BLOCK_CALL:
+                switch (x) {
+                    case CALL_LREAD:
+                    case CALL_LWRITE:
+                    case CALL_LLENGTH:
+                    case CALL_LSRTING:
+                        break;
+                    case CALL_BARRAY:
+                        if (read_int(offset) < 0) error(start, "negative array size");
+                        break;
+                    default:
+                        error(start, "invalid opcode");
+                }
+                break;
+
+            default:
+                error(start, "invalid opcode");
+        }
+        return offset;
+    }
+
+    void bytecode_verifier::flow(int32_t function, int32_t from, int32_t to, const std::string &state,
+                                 std::vector<int32_t> &work) {
+        if (to < 0 || to >= code_size || index[to] < 0) {
+            error(from, "control flow leaves the code");
+        }
+        int32_t i = index[to];
+        if (!visited[i]) {
+            visited[i] = true;
+            owner[i] = function;
+            states[i] = state;
+            work.push_back(to);
+            return;
+        }
+        if (owner[i] != function) {
+            error(from, "control flow crosses a function boundary");
+        }
+        if (states[i] != state) {
+            error(from, "unbalanced operand stack at join point");
+        }
+    }
+
+    // Abstract interpretation of the operand stack over one function
+    void bytecode_verifier::verify_function(int32_t begin) {
+        int32_t offset = begin + 1;
+        int32_t argc = read_int(offset), nlocals = read_int(offset);
+        std::vector<int32_t> work;
+
+        if (visited[index[begin]]) {
+            error(begin, "control flow falls into a function");
+        }
+        visited[index[begin]] = true;
+        owner[index[begin]] = begin;
+        work.push_back(begin);
+
+        while (!work.empty()) {
+            int32_t start = work.back();
+            work.pop_back();
+
+            std::string state = states[index[start]];
+            offset = start;
+            char x = *at(offset++),
+                    h = (x & 0xF0) >> 4,
+                    l = x & 0x0F;
+            int32_t pops = 0, pushes = 0, n;
+            char pushed = VALUE;
+            bool falls_through = true;
+
+            switch (h) {
+                case STOP:
+                    error(start, "STOP inside a function");
+                    break;
+
+                case BINOP:
+                    pops = 2, pushes = 1;
+                    break;
+
+                case BLOCK_DATE:
+                    switch (x) {
+                        case BLOCK_CONST:
+                        case BLOCK_STRING:
+                            offset += sizeof(int32_t);
+                            pushes = 1;
+                            break;
+                        case BLOCK_SEXP:
+                            offset += sizeof(int32_t);
+                            pops = read_int(offset), pushes = 1;
+                            break;
+                        case BLOCK_STA:
+                            if (state.size() < 2) error(start, "operand stack underflow");
+                            // STA stores either through an address from LDA or into an array element
+                            pops = state[state.size() - 2] == ADDRESS ? 2 : 3, pushes = 1;
+                            break;
+                        case BLOCK_JMP:
+                            flow(begin, start, read_int(offset), state, work);
+                            falls_through = false;
+                            break;
+                        case BLOCK_END:
+                            if (state.empty()) error(start, "END with an empty operand stack");
+                            falls_through = false;
+                            break;
+                        case BLOCK_DROP:
+                            pops = 1;
+                            break;
+                        case BLOCK_DUP:
+                            if (state.empty()) error(start, "operand stack underflow");
+                            pushed = state.back();
+                            pushes = 1;
+                            break;
+                        case BLOCK_SWAP:
+                            if (state.size() < 2) error(start, "operand stack underflow");
+                            std::swap(state[state.size() - 1], state[state.size() - 2]);
+                            break;
+                        case BLOCK_ELEM:
+                            pops = 2, pushes = 1;
+                            break;
+                    }
+                    break;
+
+                case LD:
+                case LDA:
+                    n = read_int(offset);
+                    check_location(start, l, n, argc, nlocals);
+                    pushes = 1;
+                    pushed = h == LDA ? ADDRESS : VALUE;
+                    break;
+
+                case ST:
+                    n = read_int(offset);
+                    check_location(start, l, n, argc, nlocals);
+                    if (state.empty()) error(start, "operand stack underflow");
+                    break;
+
+                case BLOCK_MOVE:
+                    switch (x) {
+                        case CJMPZ:
+                        case CJMPNZ:
+                            if (state.empty()) error(start, "operand stack underflow");
+                            state.pop_back();
+                            flow(begin, start, read_int(offset), state, work);
+                            break;
+                        case BEGIN:
+                        case CBEGIN:
+                            if (start != begin) error(start, "control flow falls into a function");
+                            offset += 2 * sizeof(int32_t);
+                            break;
+                        case CLOSUSRE:
+                            offset += sizeof(int32_t);
+                            n = read_int(offset);
+                            for (int32_t i = 0; i < n; i++) {
+                                char loc = *at(offset++);
+                                check_location(start, loc, read_int(offset), argc, nlocals);
+                            }
+                            pushes = 1;
+                            break;
+                        case CALLC:
+                            pops = read_int(offset) + 1, pushes = 1;
+                            break;
+                        case CALL:
+                            offset += sizeof(int32_t);
+                            pops = read_int(offset), pushes = 1;
+                            break;
+                        case PLACE_TAG:
+                            offset += 2 * sizeof(int32_t);
+                            pops = 1, pushes = 1;
+                            break;
+                        case ARRAY:
+                            offset += sizeof(int32_t);
+                            pops = 1, pushes = 1;
+                            break;
+                        case CALL_FAIL:
+                            falls_through = false;
+                            break;
+                        case LINE:
+                            offset += sizeof(int32_t);
+                            break;
+                    }
+                    break;
+
+                case PATT:
+                    pops = x == PATT_BSTRING ? 2 : 1, pushes = 1;
+                    break;
+
+                case BLOCK_CALL:
+                    switch (x) {
+                        case CALL_LREAD:
+                            pushes = 1;
+                            break;
+                        case CALL_BARRAY:
+                            pops = read_int(offset), pushes = 1;
+                            break;
+                        default:
+                            pops = 1, pushes = 1;
+                    }
+                    break;
+            }
+
+            if (pops > (int32_t) state.size()) {
+                error(start, "operand stack underflow");
+            }
+            state.resize(state.size() - pops);
+            state.append(pushes, pushed);
+
+            if (falls_through) {
+                flow(begin, start, offset, state, work);
+            }
+        }
+    }
+
+    std::vector<bool> bytecode_verifier::find_tail_calls() {
+        std::vector<bool> tail_calls(states.size(), false);
+        for (int32_t offset = 0; offset < code_size; offset++) {
+            int32_t i = index[offset];
+            char x = *at(offset);
+            if (i < 0 || !visited[i] || (x != CALL && x != CALLC)) continue;
+            int32_t argc = *reinterpret_cast<int32_t *>(at(offset + (x == CALL ? 5 : 1)));
+            int32_t next = offset + (x == CALL ? 9 : 5);
+            if (next >= code_size || *at(next) != BLOCK_END) continue;
+            // the arguments and, for CALLC, the closure below them
+            const std::string &state = states[i];
+            size_t operands = x == CALL ? argc : argc + 1;
+            tail_calls[i] = state.find(ADDRESS, state.size() - operands) == std::string::npos;
+        }
+        return tail_calls;
+    }
+
+    stack_map bytecode_verifier::verify() {
+        code_size = bf->file_ptr + bf->file_size - bf->code_ptr;
+        index.assign(code_size, -1);
+
+        int32_t offset = 0, instructions = 0;
+        bool stopped = false;
+        while (offset < code_size) {
+            index[offset] = instructions++;
+            if (((*at(offset) & 0xF0) >> 4) == STOP) {
+                stopped = true;
+                break;
+            }
+            offset = decode(offset);
+        }
+        if (!stopped) {
+            error(offset, "missing STOP");
+        }
+        if (functions.empty() || functions.front() != 0) {
+            error(0, "code does not start with BEGIN");
+        }
+
+        for (auto &j: jumps) {
+            if (j.to < 0 || j.to >= code_size || index[j.to] < 0) {
+                error(j.from, "jump target is not an instruction");
+            }
+            if (j.call && *at(j.to) != BEGIN && *at(j.to) != CBEGIN) {
+                error(j.from, "call target is not a function");
+            }
+        }
+
+        states.assign(instructions, std::string());
+        visited.assign(instructions, false);
+        owner.assign(instructions, -1);
+        for (auto begin: functions) {
+            verify_function(begin);
+        }
+
+        stack_map result;
+        result.tail_calls = find_tail_calls();
+        result.index = std::move(index);
+        result.states = std::move(states);
+        result.visited = std::move(visited);
+        return result;
+    }
+}
+
+verifier::stack_map verifier::verify(bytefile *bf) {
+    return bytecode_verifier(bf).verify();
+}
@@ -6,6 +6,7 @@
 # include <stdio.h>
 # include <errno.h>
 # include <malloc.h>
+# include <stdint.h>
 
 /* The unpacked representation of bytecode bf */
 typedef struct {
@@ -17,15 +18,26 @@ typedef struct {
     int global_area_size;        /* The size (in words) of global area             */
     int bytecode_size;           /* The size (in bytes) of bytecode                */
     int public_symbols_number;   /* The number of public symbols                   */
-    char buffer[0];
+    char *file_ptr;                /* A pointer to the read-only mapping of the file */
+    size_t file_size;              /* The size (in bytes) of the mapping             */
 } bytefile;
 
+/* Prints the message to stderr and exits */
+void failure(const char *s, ...);
+
 /* Gets a string from a string table by an index */
 char *get_string(bytefile *f, int pos);
 
-/* Reads a binary bytecode bf by name and unpacks it */
+/* Maps a binary bytecode bf by name read-only and unpacks it in place */
 bytefile *read_file(char *fname);
 
+/* FNV-1a hash of the whole file of the bytecode bf, the interpreter checks
+   that the annotations it reads are computed for the same file */
+uint64_t file_hash(bytefile *f);
+
+/* Unmaps the bytecode bf and frees its global area */
+void close_file(bytefile *f);
+
 /* Disassembles the bytecode pool */
 char *disassemble_instruction(FILE *f, bytefile *bf, char *ip);
 
@@ -0,0 +1,57 @@
+#ifndef STATIC_ANALYZER_CFG_H
+#define STATIC_ANALYZER_CFG_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "byterun.h"
+}
+
+namespace cfg {
+
+    // Each loop multiplies the estimated frequency of its body by this factor
+    const double LOOP_WEIGHT = 10.0;
+
+    struct block {
+        int32_t begin;                   // offset of the first instruction
+        int32_t end;                     // offset past the last instruction
+        int32_t instructions;
+        std::vector<int32_t> successors; // block indices within the function
+        std::vector<int32_t> predecessors;
+        std::vector<int32_t> loops;      // headers of the loops containing the block, outermost first
+        bool reachable;
+        double frequency;                // estimated executions per call of the function
+    };
+
+    struct edge {
+        int32_t from;
+        int32_t to;
+    };
+
+    struct function {
+        std::string name;
+        int32_t begin;
+        int32_t end;
+        std::vector<block> blocks;       // blocks[0] is the entry
+        std::vector<edge> back_edges;
+    };
+
+    // Splits the bytecode into functions (from a BEGIN/CBEGIN up to the next one)
+    // and every function into basic blocks. Blocks start at jump targets and
+    // after jumps, calls and END; loops are found as natural loops of back edges.
+    std::vector<function> build(bytefile *bf);
+
+    // Disassembly of the instruction at the offset, without the trailing newline
+    std::string describe(bytefile *bf, int32_t offset);
+
+    // One line per block: offsets, instruction count, loop depth, frequency and successors
+    void write_text(FILE *f, const std::vector<function> &functions);
+
+    // Graphviz digraph with a cluster per function; back edges are dashed
+    void write_dot(FILE *f, bytefile *bf, const std::vector<function> &functions);
+}
+
+#endif //STATIC_ANALYZER_CFG_H
@@ -0,0 +1,41 @@
+#ifndef STATIC_ANALYZER_INSTRUCTION_TABLE_H
+#define STATIC_ANALYZER_INSTRUCTION_TABLE_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Counts instructions by their raw bytes (opcode and operands).
+// Open addressing with linear probing; entries are kept in insertion order
+// in a separate vector, so the slots only hold indices into it.
+class instruction_table {
+public:
+    struct entry {
+        std::string bytes;
+        std::string text;
+        size_t count;
+    };
+
+    instruction_table();
+
+    // Returns the entry for the instruction, inserting it with zero count
+    entry &operator[](std::string_view bytes);
+
+    std::vector<entry>::iterator begin() { return entries.begin(); }
+
+    std::vector<entry>::iterator end() { return entries.end(); }
+
+    size_t size() const { return entries.size(); }
+
+private:
+    std::vector<entry> entries;
+    std::vector<uint64_t> hashes;
+    std::vector<int32_t> slots;
+
+    static uint64_t hash(std::string_view bytes);
+
+    void grow();
+};
+
+#endif //STATIC_ANALYZER_INSTRUCTION_TABLE_H
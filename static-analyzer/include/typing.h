@@ -0,0 +1,39 @@
+#ifndef STATIC_ANALYZER_TYPING_H
+#define STATIC_ANALYZER_TYPING_H
+
+#include "cfg.h"
+
+namespace typing {
+
+    // Abstract values form a powerset lattice: join is bitwise or,
+    // NONE is "not reached yet" and only INTEGER is a useful fact
+    enum kind : uint8_t {
+        NONE = 0,
+        INTEGER = 1,   // a tagged integer
+        ADDRESS = 2,   // a variable address pushed by LDA
+        REFERENCE = 4, // a heap object (string, array, sexp, closure)
+        ANY = INTEGER | ADDRESS | REFERENCE
+    };
+
+    // Instructions that consume integers: BINOP, CJMPz and CJMPnz
+    struct site {
+        int32_t offset;
+        uint8_t opcode;
+        bool integer_operands; // every operand is an integer whenever the site runs
+        double frequency;      // estimated executions per call of the enclosing function
+    };
+
+    // Forward dataflow over operand stack slots, locals and args of every function.
+    // Calls are handled interprocedurally: argument kinds are joined over the direct
+    // CALL sites of a function (unless it also becomes a closure) and the result of
+    // a CALL is the join of the values left by END in the callee.
+    std::vector<site> analyze(bytefile *bf, const std::vector<cfg::function> &functions);
+
+    // Share of sites (and of their estimated executions) with integer operands
+    void write_report(FILE *f, const std::vector<site> &sites);
+
+    // The sites with integer operands, one per line, for `iterative-interpreter/build/main --annotations`
+    void write_annotations(FILE *f, bytefile *bf, const std::vector<site> &sites);
+}
+
+#endif //STATIC_ANALYZER_TYPING_H
@@ -6,6 +6,11 @@
 # include <malloc.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 # include "byterun.h"
 
 static void vfailure(char *s, va_list args) {
@@ -26,43 +31,99 @@ char *get_string(bytefile *f, int pos) {
     return &f->string_ptr[pos];
 }
 
-/* Reads a binary bytecode bf by name and unpacks it */
+/* Maps a binary bytecode bf by name read-only and unpacks it in place */
 bytefile *read_file(char *fname) {
-    FILE *f = fopen(fname, "rb");
-    long size;
+    int fd = open(fname, O_RDONLY);
+    struct stat st;
+    size_t size, rest;
+    int *header;
     bytefile *file;
 
-    if (f == 0) {
+    if (fd == -1) {
         failure("%s\n", strerror(errno));
     }
 
-    if (fseek(f, 0, SEEK_END) == -1) {
+    if (fstat(fd, &st) == -1) {
         failure("%s\n", strerror(errno));
     }
 
-    file = (bytefile *) malloc(sizeof(int) * 4 + (size = ftell(f)));
+    size = st.st_size;
+
+    if (size < 3 * sizeof(int)) {
+        failure("%s: bytecode file is too short\n", fname);
+    }
+
+    header = (int *) mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (header == MAP_FAILED) {
+        failure("%s\n", strerror(errno));
+    }
+
+    close(fd);
+
+    file = (bytefile *) malloc(sizeof(bytefile));
 
     if (file == 0) {
         failure("*** FAILURE: unable to allocate memory.\n");
     }
 
-    rewind(f);
+    file->file_ptr = (char *) header;
+    file->file_size = size;
+    file->stringtab_size = header[0];
+    file->global_area_size = header[1];
+    file->public_symbols_number = header[2];
 
-    if (size != fread(&file->stringtab_size, 1, size, f)) {
-        failure("%s\n", strerror(errno));
+    rest = size - 3 * sizeof(int);
+
+    if (file->public_symbols_number < 0
+        || file->public_symbols_number > rest / (2 * sizeof(int))) {
+        failure("%s: invalid number of public symbols %d\n", fname, file->public_symbols_number);
     }
 
-    fclose(f);
+    rest -= file->public_symbols_number * 2 * sizeof(int);
 
-    file->string_ptr = &file->buffer[file->public_symbols_number * 2 * sizeof(int)];
-    file->public_ptr = (int *) file->buffer;
+    if (file->stringtab_size < 0 || file->stringtab_size > rest) {
+        failure("%s: invalid string table size %d\n", fname, file->stringtab_size);
+    }
+
+    if (file->global_area_size < 0 || file->global_area_size > INT_MAX / sizeof(int)) {
+        failure("%s: invalid global area size %d\n", fname, file->global_area_size);
+    }
+
+    file->public_ptr = header + 3;
+    file->string_ptr = (char *) (file->public_ptr + file->public_symbols_number * 2);
     file->code_ptr = &file->string_ptr[file->stringtab_size];
+    file->bytecode_size = rest - file->stringtab_size;
+
+    if (file->stringtab_size > 0 && file->string_ptr[file->stringtab_size - 1] != 0) {
+        failure("%s: string table is not terminated\n", fname);
+    }
+
     file->global_ptr = (int *) malloc(file->global_area_size * sizeof(int));
-    file->bytecode_size = (char *) &file->stringtab_size + size - file->code_ptr;
+
+    if (file->global_ptr == 0 && file->global_area_size != 0) {
+        failure("*** FAILURE: unable to allocate memory.\n");
+    }
 
     return file;
 }
 
+/* FNV-1a hash of the whole file of the bytecode bf */
+uint64_t file_hash(bytefile *f) {
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < f->file_size; i++) {
+        h = (h ^ (unsigned char) f->file_ptr[i]) * 1099511628211ull;
+    }
+    return h;
+}
+
+/* Unmaps the bytecode bf and frees its global area */
+void close_file(bytefile *f) {
+    munmap(f->file_ptr, f->file_size);
+    free(f->global_ptr);
+    free(f);
+}
+
 void logger(FILE *f, const char *format, ...) {
     if (f == NULL) return;
 
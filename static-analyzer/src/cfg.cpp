@@ -0,0 +1,369 @@
+#include "cfg.h"
+#include "opcodes.h"
+#include <algorithm>
+#include <cmath>
+
+namespace cfg {
+
+    namespace {
+
+        unsigned char opcode_at(bytefile *bf, int32_t offset) {
+            return bf->code_ptr[offset];
+        }
+
+        int32_t operand_at(bytefile *bf, int32_t offset) {
+            return *(int32_t *) (bf->code_ptr + offset + 1);
+        }
+
+        bool is_jump(unsigned char opcode) {
+            return opcode == BLOCK_JMP || opcode == CJMPZ || opcode == CJMPNZ;
+        }
+
+        // Control does not continue to the next instruction
+        bool is_terminator(unsigned char opcode) {
+            return opcode == BLOCK_JMP || opcode == BLOCK_END || opcode == BLOCK_RET
+                   || opcode == CALL_FAIL || (opcode >> 4) == STOP;
+        }
+
+        bool ends_block(unsigned char opcode) {
+            return is_jump(opcode) || is_terminator(opcode) || opcode == CALL || opcode == CALLC;
+        }
+
+        std::string function_name(bytefile *bf, int32_t offset) {
+            for (int i = 0; i < bf->public_symbols_number; i++) {
+                if (bf->public_ptr[2 * i + 1] == offset) {
+                    return get_string(bf, bf->public_ptr[2 * i]);
+                }
+            }
+            char name[16];
+            snprintf(name, sizeof(name), "L%.8x", offset);
+            return name;
+        }
+
+        class cfg_builder {
+        public:
+            explicit cfg_builder(bytefile *file) : bf(file) {}
+
+            std::vector<function> build();
+
+        private:
+            bytefile *bf;
+
+            // offsets of all instructions, in order, and whether an offset starts one
+            std::vector<int32_t> starts;
+            std::vector<bool> is_start;
+
+            int32_t next_start(size_t i, int32_t end);
+
+            function build_function(size_t first, size_t last);
+
+            std::vector<int32_t> reverse_postorder(const function &fn);
+
+            void find_loops(function &fn, const std::vector<int32_t> &order);
+
+            void estimate_frequencies(function &fn, const std::vector<int32_t> &order);
+        };
+
+        std::vector<function> cfg_builder::build() {
+            int32_t size = bf->bytecode_size;
+            is_start.assign(size + 1, false);
+            char *ip = bf->code_ptr;
+            while (ip != nullptr && ip < bf->code_ptr + size) {
+                starts.push_back(ip - bf->code_ptr);
+                is_start[starts.back()] = true;
+                ip = disassemble_instruction(nullptr, bf, ip);
+            }
+
+            std::vector<function> functions;
+            size_t first = 0;
+            for (size_t i = 1; i <= starts.size(); i++) {
+                if (i == starts.size() || opcode_at(bf, starts[i]) == BEGIN || opcode_at(bf, starts[i]) == CBEGIN) {
+                    functions.push_back(build_function(first, i));
+                    first = i;
+                }
+            }
+            return functions;
+        }
+
+        int32_t cfg_builder::next_start(size_t i, int32_t end) {
+            return i + 1 < starts.size() ? starts[i + 1] : end;
+        }
+
+        // Instructions starts[first..last) form the function
+        function cfg_builder::build_function(size_t first, size_t last) {
+            function fn;
+            fn.begin = starts[first];
+            fn.end = last < starts.size() ? starts[last] : bf->bytecode_size;
+            fn.name = function_name(bf, fn.begin);
+
+            auto inside = [&](int32_t offset) {
+                return offset >= fn.begin && offset < fn.end && is_start[offset];
+            };
+
+            std::vector<bool> leader(fn.end - fn.begin, false);
+            leader[0] = true;
+            for (size_t i = first; i < last; i++) {
+                unsigned char opcode = opcode_at(bf, starts[i]);
+                if (is_jump(opcode)) {
+                    int32_t target = operand_at(bf, starts[i]);
+                    if (!inside(target)) {
+                        failure("CFG: jump at 0x%.8x leaves the function at 0x%.8x\n", starts[i], fn.begin);
+                    }
+                    leader[target - fn.begin] = true;
+                }
+                if (ends_block(opcode) && i + 1 < last) {
+                    leader[starts[i + 1] - fn.begin] = true;
+                }
+            }
+
+            std::vector<int32_t> block_of(fn.end - fn.begin, -1);
+            for (size_t i = first; i < last; i++) {
+                int32_t offset = starts[i];
+                if (leader[offset - fn.begin]) {
+                    fn.blocks.push_back({offset, offset, 0, {}, {}, {}, false, 0.0});
+                }
+                block &b = fn.blocks.back();
+                b.end = next_start(i, fn.end);
+                b.instructions++;
+                block_of[offset - fn.begin] = fn.blocks.size() - 1;
+            }
+
+            for (size_t i = first; i < last; i++) {
+                int32_t offset = starts[i];
+                int32_t next = next_start(i, fn.end);
+                if (next < fn.end && !leader[next - fn.begin]) continue;
+
+                int32_t from = block_of[offset - fn.begin];
+                unsigned char opcode = opcode_at(bf, offset);
+                auto link = [&](int32_t to) {
+                    auto &successors = fn.blocks[from].successors;
+                    if (std::find(successors.begin(), successors.end(), to) == successors.end()) {
+                        successors.push_back(to);
+                        fn.blocks[to].predecessors.push_back(from);
+                    }
+                };
+                if (is_jump(opcode)) {
+                    link(block_of[operand_at(bf, offset) - fn.begin]);
+                }
+                if (!is_terminator(opcode) && next < fn.end) {
+                    link(block_of[next - fn.begin]);
+                }
+            }
+
+            std::vector<int32_t> order = reverse_postorder(fn);
+            find_loops(fn, order);
+            estimate_frequencies(fn, order);
+            return fn;
+        }
+
+        std::vector<int32_t> cfg_builder::reverse_postorder(const function &fn) {
+            std::vector<int32_t> order;
+            std::vector<bool> seen(fn.blocks.size(), false);
+            std::vector<std::pair<int32_t, size_t>> stack = {{0, 0}};
+            seen[0] = true;
+            while (!stack.empty()) {
+                auto &[b, next] = stack.back();
+                if (next < fn.blocks[b].successors.size()) {
+                    int32_t s = fn.blocks[b].successors[next++];
+                    if (!seen[s]) {
+                        seen[s] = true;
+                        stack.emplace_back(s, 0);
+                    }
+                } else {
+                    order.push_back(b);
+                    stack.pop_back();
+                }
+            }
+            std::reverse(order.begin(), order.end());
+            return order;
+        }
+
+        // Dominators by the Cooper-Harvey-Kennedy iteration over the reverse postorder,
+        // then natural loops of the back edges (edges into a dominator)
+        void cfg_builder::find_loops(function &fn, const std::vector<int32_t> &order) {
+            size_t n = fn.blocks.size();
+            std::vector<int32_t> position(n, -1);
+            for (size_t i = 0; i < order.size(); i++) {
+                position[order[i]] = i;
+                fn.blocks[order[i]].reachable = true;
+            }
+
+            std::vector<int32_t> idom(n, -1);
+            idom[0] = 0;
+            auto intersect = [&](int32_t a, int32_t b) {
+                while (a != b) {
+                    while (position[a] > position[b]) a = idom[a];
+                    while (position[b] > position[a]) b = idom[b];
+                }
+                return a;
+            };
+            for (bool changed = true; changed;) {
+                changed = false;
+                for (size_t i = 1; i < order.size(); i++) {
+                    int32_t b = order[i], dom = -1;
+                    for (int32_t p: fn.blocks[b].predecessors) {
+                        if (idom[p] < 0) continue;
+                        dom = dom < 0 ? p : intersect(p, dom);
+                    }
+                    if (dom != idom[b]) {
+                        idom[b] = dom;
+                        changed = true;
+                    }
+                }
+            }
+            auto dominates = [&](int32_t a, int32_t b) {
+                for (;; b = idom[b]) {
+                    if (a == b) return true;
+                    if (b == 0) return false;
+                }
+            };
+
+            std::vector<std::vector<bool>> bodies(n);
+            for (int32_t b: order) {
+                for (int32_t s: fn.blocks[b].successors) {
+                    if (!dominates(s, b)) continue;
+                    fn.back_edges.push_back({b, s});
+                    auto &body = bodies[s];
+                    body.resize(n, false);
+                    body[s] = true;
+                    std::vector<int32_t> work = {b};
+                    while (!work.empty()) {
+                        int32_t w = work.back();
+                        work.pop_back();
+                        if (body[w]) continue;
+                        body[w] = true;
+                        for (int32_t p: fn.blocks[w].predecessors) {
+                            if (fn.blocks[p].reachable) work.push_back(p);
+                        }
+                    }
+                }
+            }
+
+            std::vector<size_t> body_size(n, 0);
+            for (size_t h = 0; h < n; h++) {
+                body_size[h] = std::count(bodies[h].begin(), bodies[h].end(), true);
+            }
+            for (size_t h = 0; h < n; h++) {
+                for (size_t b = 0; b < bodies[h].size(); b++) {
+                    if (bodies[h][b]) fn.blocks[b].loops.push_back(h);
+                }
+            }
+            // nested loops have strictly smaller bodies
+            for (auto &b: fn.blocks) {
+                std::sort(b.loops.begin(), b.loops.end(), [&](int32_t x, int32_t y) {
+                    return body_size[x] > body_size[y] || (body_size[x] == body_size[y] && x < y);
+                });
+            }
+        }
+
+        // Branches are taken with equal probability, a loop header runs LOOP_WEIGHT
+        // times per entry into the loop, and leaving a loop divides by LOOP_WEIGHT again
+        void cfg_builder::estimate_frequencies(function &fn, const std::vector<int32_t> &order) {
+            auto is_back_edge = [&](int32_t from, int32_t to) {
+                for (auto &e: fn.back_edges) {
+                    if (e.from == from && e.to == to) return true;
+                }
+                return false;
+            };
+            auto is_header = [&](int32_t b) {
+                auto &loops = fn.blocks[b].loops;
+                return std::find(loops.begin(), loops.end(), b) != loops.end();
+            };
+
+            for (int32_t b: order) {
+                block &current = fn.blocks[b];
+                double frequency = b == 0 ? 1.0 : 0.0;
+                for (int32_t p: current.predecessors) {
+                    const block &pred = fn.blocks[p];
+                    if (!pred.reachable || is_back_edge(p, b)) continue;
+                    int exits = 0;
+                    for (int32_t h: pred.loops) {
+                        if (std::find(current.loops.begin(), current.loops.end(), h) == current.loops.end()) exits++;
+                    }
+                    frequency += pred.frequency / pred.successors.size() / std::pow(LOOP_WEIGHT, exits);
+                }
+                current.frequency = is_header(b) ? frequency * LOOP_WEIGHT : frequency;
+            }
+        }
+
+        std::string escape(const std::string &text) {
+            std::string result;
+            for (char c: text) {
+                if (c == '"' || c == '\\') result += '\\';
+                result += c == '\t' ? ' ' : c;
+            }
+            return result;
+        }
+    }
+
+    std::vector<function> build(bytefile *bf) {
+        return cfg_builder(bf).build();
+    }
+
+    std::string describe(bytefile *bf, int32_t offset) {
+        char *text = nullptr;
+        size_t size = 0;
+        FILE *stream = open_memstream(&text, &size);
+        disassemble_instruction(stream, bf, bf->code_ptr + offset);
+        fclose(stream);
+        std::string result(text, size);
+        free(text);
+        while (!result.empty() && result.back() == '\n') {
+            result.pop_back();
+        }
+        return result;
+    }
+
+    void write_text(FILE *f, const std::vector<function> &functions) {
+        for (auto &fn: functions) {
+            fprintf(f, "function %s 0x%.8x-0x%.8x, %zu blocks, %zu back edges\n", fn.name.c_str(),
+                    fn.begin, fn.end, fn.blocks.size(), fn.back_edges.size());
+            for (auto &b: fn.blocks) {
+                fprintf(f, "  block 0x%.8x-0x%.8x %4d instr", b.begin, b.end, b.instructions);
+                if (b.reachable) {
+                    fprintf(f, "  depth %zu  freq %10.2f", b.loops.size(), b.frequency);
+                } else {
+                    fprintf(f, "  unreachable");
+                }
+                fprintf(f, "  ->");
+                for (int32_t s: b.successors) {
+                    fprintf(f, " 0x%.8x", fn.blocks[s].begin);
+                }
+                fprintf(f, "\n");
+            }
+        }
+    }
+
+    void write_dot(FILE *f, bytefile *bf, const std::vector<function> &functions) {
+        fprintf(f, "digraph cfg {\n");
+        fprintf(f, "    node [shape=box fontname=\"monospace\"];\n");
+        for (size_t i = 0; i < functions.size(); i++) {
+            auto &fn = functions[i];
+            fprintf(f, "    subgraph cluster_%zu {\n", i);
+            fprintf(f, "        label=\"%s\";\n", escape(fn.name).c_str());
+            for (auto &b: fn.blocks) {
+                fprintf(f, "        b%.8x [label=\"0x%.8x  depth %zu  freq %.2f\\l", b.begin, b.begin,
+                        b.loops.size(), b.frequency);
+                for (int32_t offset = b.begin; offset < b.end;) {
+                    fprintf(f, "%s\\l", escape(describe(bf, offset)).c_str());
+                    char *next = disassemble_instruction(nullptr, bf, bf->code_ptr + offset);
+                    if (next == nullptr) break;
+                    offset = next - bf->code_ptr;
+                }
+                fprintf(f, "\"%s];\n", b.reachable ? "" : " style=dotted");
+            }
+            for (size_t from = 0; from < fn.blocks.size(); from++) {
+                for (int32_t to: fn.blocks[from].successors) {
+                    bool back = false;
+                    for (auto &e: fn.back_edges) {
+                        back = back || (e.from == (int32_t) from && e.to == to);
+                    }
+                    fprintf(f, "        b%.8x -> b%.8x%s;\n", fn.blocks[from].begin, fn.blocks[to].begin,
+                            back ? " [style=dashed]" : "");
+                }
+            }
+            fprintf(f, "    }\n");
+        }
+        fprintf(f, "}\n");
+    }
+}
@@ -0,0 +1,51 @@
+#include "instruction_table.h"
+
+namespace {
+    const size_t INITIAL_SLOTS = 256;
+    const int32_t EMPTY = -1;
+}
+
+instruction_table::instruction_table() : slots(INITIAL_SLOTS, EMPTY) {}
+
+// FNV-1a: instructions are at most 9 bytes long, so a byte loop is cheap enough
+uint64_t instruction_table::hash(std::string_view bytes) {
+    uint64_t h = 14695981039346656037ull;
+    for (char c: bytes) {
+        h ^= (unsigned char) c;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+instruction_table::entry &instruction_table::operator[](std::string_view bytes) {
+    uint64_t h = hash(bytes);
+    size_t mask = slots.size() - 1;
+    for (size_t i = h & mask;; i = (i + 1) & mask) {
+        int32_t index = slots[i];
+        if (index == EMPTY) {
+            if (2 * (entries.size() + 1) > slots.size()) {
+                grow();
+                return (*this)[bytes];
+            }
+            slots[i] = entries.size();
+            hashes.push_back(h);
+            entries.push_back({std::string(bytes), std::string(), 0});
+            return entries.back();
+        }
+        if (hashes[index] == h && entries[index].bytes == bytes) {
+            return entries[index];
+        }
+    }
+}
+
+void instruction_table::grow() {
+    slots.assign(2 * slots.size(), EMPTY);
+    size_t mask = slots.size() - 1;
+    for (size_t index = 0; index < entries.size(); index++) {
+        size_t i = hashes[index] & mask;
+        while (slots[i] != EMPTY) {
+            i = (i + 1) & mask;
+        }
+        slots[i] = index;
+    }
+}
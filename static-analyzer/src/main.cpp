@@ -2,76 +2,233 @@
 #include <map>
 #include <vector>
 #include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include "instruction_table.h"
+#include "cfg.h"
+#include "typing.h"
 
 extern "C" {
 #include "byterun.h"
 }
 
-struct instruction {
-    instruction(char *name, long len) : name(name), len(len) {}
+// Instruction counts of one file, with the disassembly of every instruction
+// rendered while the file (and its string table) is still mapped
+static instruction_table count_instructions(const std::string &file_name) {
+    bytefile *bf = read_file((char *) file_name.c_str());
+    char *ip = bf->code_ptr;
+    char *end = bf->code_ptr + bf->bytecode_size;
+    instruction_table counter;
 
-    instruction(const instruction &other) = default;
+    while (ip < end) {
+        char *next_ip = disassemble_instruction(nullptr, bf, ip);
+        // <end> instruction
+        long len = next_ip == nullptr ? 1 : next_ip - ip;
+        counter[std::string_view(ip, len)].count++;
+        if (next_ip == nullptr) break;
+        ip = next_ip;
+    }
 
-    char *name;
-    long len;
+    for (auto &entry: counter) {
+        char *text = nullptr;
+        size_t size = 0;
+        FILE *stream = open_memstream(&text, &size);
+        disassemble_instruction(stream, bf, entry.bytes.data());
+        fclose(stream);
+        entry.text.assign(text, size);
+        free(text);
+    }
 
-    bool operator<(const instruction &other) const {
-        int i = 0;
-        for (; i < std::min(this->len, other.len); i++) {
-            if (this->name[i] != other.name[i]) return this->name[i] < other.name[i];
+    close_file(bf);
+    return counter;
+}
+
+// Files are handed out to the workers one by one, so that a few large files
+// do not leave the other workers idle
+static std::vector<instruction_table> count_in_parallel(const std::vector<std::string> &file_names, unsigned jobs) {
+    std::vector<instruction_table> counters(file_names.size());
+    std::atomic<size_t> next(0);
+
+    auto worker = [&]() {
+        for (size_t i = next++; i < file_names.size(); i = next++) {
+            counters[i] = count_instructions(file_names[i]);
         }
-        return (i != other.len);
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < jobs && i < file_names.size(); i++) {
+        pool.emplace_back(worker);
     }
-};
+    worker();
+    for (auto &thread: pool) {
+        thread.join();
+    }
+    return counters;
+}
 
-struct statistic {
-    statistic(instruction instr, size_t count) : instr(instr), count(count) {}
+// Directories are scanned recursively for .bc files
+static std::vector<std::string> collect_files(const std::vector<std::string> &paths) {
+    std::vector<std::string> file_names;
+    for (auto &path: paths) {
+        if (!std::filesystem::is_directory(path)) {
+            file_names.push_back(path);
+            continue;
+        }
+        std::vector<std::string> found;
+        for (auto &item: std::filesystem::recursive_directory_iterator(path)) {
+            if (item.is_regular_file() && item.path().extension() == ".bc") {
+                found.push_back(item.path().string());
+            }
+        }
+        std::sort(found.begin(), found.end());
+        file_names.insert(file_names.end(), found.begin(), found.end());
+    }
+    return file_names;
+}
 
-    statistic(const statistic &other) = default;
+static void static_statistics(const std::vector<std::string> &paths, unsigned jobs) {
+    std::vector<std::string> file_names = collect_files(paths);
+    std::vector<instruction_table> counters = count_in_parallel(file_names, jobs);
+
+    // Merged in file order, so the disassembly shown for an instruction is
+    // always taken from the first file it occurs in
+    instruction_table merged;
+    for (auto &counter: counters) {
+        for (auto &entry: counter) {
+            auto &total = merged[entry.bytes];
+            if (total.count == 0) {
+                total.text = std::move(entry.text);
+            }
+            total.count += entry.count;
+        }
+    }
 
-    instruction instr;
+    std::vector<instruction_table::entry *> sorted_instr;
+    sorted_instr.reserve(merged.size());
+    for (auto &entry: merged) {
+        sorted_instr.push_back(&entry);
+    }
+
+    // Ties are ordered by the instruction bytes compared as (signed) chars
+    std::sort(sorted_instr.begin(), sorted_instr.end(), [](auto *a, auto *b) {
+        return a->count > b->count || (a->count == b->count &&
+                                       std::lexicographical_compare(a->bytes.begin(), a->bytes.end(),
+                                                                    b->bytes.begin(), b->bytes.end()));
+    });
+
+    FILE *f = stdout;
+
+    for (auto *entry: sorted_instr) {
+        fprintf(f, "%zu: %s", entry->count, entry->text.c_str());
+    }
+}
+
+struct ngram {
+    ngram(std::string name, size_t count) : name(std::move(name)), count(count) {}
+
+    std::string name;
     size_t count;
 
-    bool operator<(const statistic &other) const {
-        return this->count > other.count || (this->count == other.count && this->instr < other.instr);
+    bool operator<(const ngram &other) const {
+        return this->count > other.count || (this->count == other.count && this->name < other.name);
     }
 };
 
-int main(int argc, char *argv[]) {
-    bytefile *bf = read_file(argv[1]);
-    char *ip = bf->code_ptr;
-    std::map<instruction, size_t> counter;
+// Merges n-gram files written by `iterative-interpreter/build/main --ngrams`.
+// Every line is "n<TAB>count<TAB>opcode bytes<TAB>mnemonics"; n-grams are
+// keyed by their opcode bytes, since mnemonics are only for reading
+static void dynamic_statistics(int count, char *file_names[]) {
+    std::map<int, std::map<std::string, std::pair<std::string, size_t>>> merged;
 
-    while (ip < bf->code_ptr + bf->bytecode_size) {
-        char *next_ip = disassemble_instruction(nullptr, bf, ip);
-        if (next_ip == nullptr) break;
-        long len = next_ip - ip;
-        auto instr = instruction(ip, len);
-        counter[instr]++;
-        ip = next_ip;
+    for (int i = 0; i < count; i++) {
+        std::ifstream in(file_names[i]);
+        if (!in) {
+            failure("cannot open %s\n", file_names[i]);
+        }
+        std::string line;
+        while (std::getline(in, line)) {
+            if (line.empty() || line[0] == '#') continue;
+            std::istringstream fields(line);
+            std::string n, times, opcodes, names;
+            if (!std::getline(fields, n, '\t') || !std::getline(fields, times, '\t') ||
+                !std::getline(fields, opcodes, '\t') || !std::getline(fields, names)) {
+                failure("%s: malformed line \"%s\"\n", file_names[i], line.c_str());
+            }
+            auto &entry = merged[std::stoi(n)][opcodes];
+            entry.first = names;
+            entry.second += std::stoull(times);
+        }
     }
 
-    // <end> instruction
-    counter[{ip, 1}]++;
+    FILE *f = stdout;
 
-    std::vector<statistic> sorted_instr;
-    sorted_instr.reserve(counter.size());
-    for (auto [key, item]: counter) {
-        sorted_instr.emplace_back(key, item);
-    }
+    for (auto &[n, table]: merged) {
+        size_t total = 0;
+        std::vector<ngram> sorted;
+        sorted.reserve(table.size());
+        for (auto &[_, entry]: table) {
+            sorted.emplace_back(entry.first, entry.second);
+            total += entry.second;
+        }
+        std::sort(sorted.begin(), sorted.end());
 
-    std::sort(sorted_instr.begin(), sorted_instr.end());
+        fprintf(f, "=== %d-grams ===\n", n);
+        for (auto &[name, times]: sorted) {
+            fprintf(f, "%zu (%.2f%%): %s\n", times, 100.0 * times / total, name.c_str());
+        }
+    }
+}
 
-    FILE *f = stdout;
+int main(int argc, char *argv[]) {
+    if (argc >= 2 && strcmp(argv[1], "--dynamic") == 0) {
+        dynamic_statistics(argc - 2, argv + 2);
+        return 0;
+    }
+    if (argc == 3 && (strcmp(argv[1], "--cfg") == 0 || strcmp(argv[1], "--dot") == 0)) {
+        bytefile *bf = read_file(argv[2]);
+        auto functions = cfg::build(bf);
+        if (argv[1][2] == 'c') {
+            cfg::write_text(stdout, functions);
+        } else {
+            cfg::write_dot(stdout, bf, functions);
+        }
+        close_file(bf);
+        return 0;
+    }
+    if (argc == 3 && strcmp(argv[1], "--types") == 0) {
+        bytefile *bf = read_file(argv[2]);
+        auto sites = typing::analyze(bf, cfg::build(bf));
+        typing::write_report(stdout, sites);
+        std::string annotations_name = std::string(argv[2]) + ".types";
+        FILE *out = fopen(annotations_name.c_str(), "w");
+        if (out == nullptr) {
+            failure("cannot open %s for writing\n", annotations_name.c_str());
+        }
+        typing::write_annotations(out, bf, sites);
+        fclose(out);
+        close_file(bf);
+        return 0;
+    }
 
-    for (auto [instr, count]: sorted_instr) {
-        auto [name, len] = instr;
-        fprintf(f, "%zu: ", count);
-        disassemble_instruction(f, bf, name);
+    unsigned jobs = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            jobs = std::max(1, atoi(argv[++i]));
+        } else {
+            paths.emplace_back(argv[i]);
+        }
     }
 
-    free(bf->global_ptr);
-    free(bf);
+    if (paths.empty()) {
+        failure("usage: %s [-j jobs] <file.bc | directory>... | --cfg <file.bc> | --dot <file.bc> | --types <file.bc> | --dynamic <file.ngrams>...\n", argv[0]);
+    }
+    static_statistics(paths, jobs);
 
     return 0;
-}
\ No newline at end of file
+}
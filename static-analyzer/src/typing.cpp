@@ -0,0 +1,424 @@
+#include "typing.h"
+#include "opcodes.h"
+#include <deque>
+#include <map>
+
+namespace typing {
+
+    namespace {
+
+        // Whatever a variable or a heap field may hold
+        const uint8_t UNKNOWN = INTEGER | REFERENCE;
+
+        struct state {
+            bool reached = false;
+            std::vector<uint8_t> stack;
+            std::vector<uint8_t> locals;
+            std::vector<uint8_t> args;
+
+            // Returns whether the state has grown
+            bool join(const state &other, int32_t offset) {
+                if (!reached) {
+                    *this = other;
+                    return true;
+                }
+                if (stack.size() != other.stack.size()) {
+                    failure("TYPING: operand stack depth differs at 0x%.8x\n", offset);
+                }
+                bool grown = false;
+                auto merge = [&](std::vector<uint8_t> &to, const std::vector<uint8_t> &from) {
+                    for (size_t i = 0; i < to.size(); i++) {
+                        grown |= (to[i] | from[i]) != to[i];
+                        to[i] |= from[i];
+                    }
+                };
+                merge(stack, other.stack);
+                merge(locals, other.locals);
+                merge(args, other.args);
+                return grown;
+            }
+        };
+
+        struct summary {
+            int32_t argc = 0;
+            int32_t nlocals = 0;
+            bool escapes = false;          // also called through a closure
+            std::vector<uint8_t> args;     // joined over the direct CALL sites
+            std::vector<bool> args_taken;  // address taken by LDA, so STA may change them
+            std::vector<bool> locals_taken;
+            uint8_t result = NONE;         // joined over END
+        };
+
+        int32_t operand_at(bytefile *bf, int32_t offset, int n = 0) {
+            return *(int32_t *) (bf->code_ptr + offset + 1 + n * sizeof(int32_t));
+        }
+
+        class type_analyzer {
+        public:
+            type_analyzer(bytefile *file, const std::vector<cfg::function> &functions)
+                    : bf(file), functions(functions), changed(false) {}
+
+            std::vector<site> analyze();
+
+        private:
+            bytefile *bf;
+            const std::vector<cfg::function> &functions;
+            std::map<int32_t, size_t> function_at;
+            std::vector<summary> summaries;
+            // join of the operand kinds seen at every BINOP and CJMP
+            std::map<int32_t, uint8_t> operands;
+            bool changed;
+
+            void prepare();
+
+            void analyze_function(size_t f);
+
+            void transfer(size_t f, int32_t offset, state &s);
+
+            uint8_t pop(state &s, int32_t offset);
+
+            uint8_t &variable(size_t f, state &s, char l, int32_t i, uint8_t &scratch);
+
+            void record(int32_t offset, uint8_t kind);
+
+            void update(uint8_t &to, uint8_t kind);
+        };
+
+        void type_analyzer::prepare() {
+            summaries.resize(functions.size());
+            for (size_t f = 0; f < functions.size(); f++) {
+                int32_t begin = functions[f].begin;
+                function_at[begin] = f;
+                unsigned char opcode = bf->code_ptr[begin];
+                if (opcode != BEGIN && opcode != CBEGIN) continue;
+                auto &sum = summaries[f];
+                sum.argc = operand_at(bf, begin, 0);
+                sum.nlocals = operand_at(bf, begin, 1);
+                sum.args.assign(sum.argc, NONE);
+                sum.args_taken.assign(sum.argc, false);
+                sum.locals_taken.assign(sum.nlocals, false);
+                // the entry point is called by the runtime
+                sum.escapes = opcode == CBEGIN || begin == 0;
+            }
+
+            for (size_t f = 0; f < functions.size(); f++) {
+                for (auto &b: functions[f].blocks) {
+                    for (char *ip = bf->code_ptr + b.begin; ip != nullptr && ip < bf->code_ptr + b.end;) {
+                        int32_t offset = ip - bf->code_ptr;
+                        unsigned char opcode = *ip;
+                        if (opcode == CLOSUSRE && function_at.count(operand_at(bf, offset))) {
+                            summaries[function_at[operand_at(bf, offset)]].escapes = true;
+                        }
+                        if ((opcode >> 4) == LDA) {
+                            int32_t i = operand_at(bf, offset);
+                            auto &taken = (opcode & 0x0F) == LOCAL ? summaries[f].locals_taken
+                                                                   : summaries[f].args_taken;
+                            if (((opcode & 0x0F) == LOCAL || (opcode & 0x0F) == ARGS) && i >= 0
+                                && i < (int32_t) taken.size()) {
+                                taken[i] = true;
+                            }
+                        }
+                        ip = disassemble_instruction(nullptr, bf, ip);
+                    }
+                }
+            }
+        }
+
+        void type_analyzer::update(uint8_t &to, uint8_t kind) {
+            if ((to | kind) != to) {
+                to |= kind;
+                changed = true;
+            }
+        }
+
+        void type_analyzer::record(int32_t offset, uint8_t kind) {
+            operands[offset] |= kind;
+        }
+
+        uint8_t type_analyzer::pop(state &s, int32_t offset) {
+            if (s.stack.empty()) {
+                failure("TYPING: operand stack underflow at 0x%.8x\n", offset);
+            }
+            uint8_t kind = s.stack.back();
+            s.stack.pop_back();
+            return kind;
+        }
+
+        // Globals, captured variables and variables whose address is taken
+        // are not tracked: they read as UNKNOWN and writes to them are dropped
+        uint8_t &type_analyzer::variable(size_t f, state &s, char l, int32_t i, uint8_t &scratch) {
+            auto &sum = summaries[f];
+            scratch = UNKNOWN;
+            if (l == LOCAL && i >= 0 && i < (int32_t) s.locals.size() && !sum.locals_taken[i]) {
+                return s.locals[i];
+            }
+            if (l == ARGS && i >= 0 && i < (int32_t) s.args.size() && !sum.args_taken[i]) {
+                return s.args[i];
+            }
+            return scratch;
+        }
+
+        void type_analyzer::transfer(size_t f, int32_t offset, state &s) {
+            unsigned char x = bf->code_ptr[offset];
+            char h = x >> 4, l = x & 0x0F;
+            uint8_t scratch;
+
+            switch (h) {
+                case STOP:
+                    return;
+
+                case BINOP: {
+                    uint8_t b = pop(s, offset), a = pop(s, offset);
+                    record(offset, a | b);
+                    s.stack.push_back(INTEGER);
+                    return;
+                }
+
+                case LD:
+                    s.stack.push_back(variable(f, s, l, operand_at(bf, offset), scratch));
+                    return;
+
+                case LDA:
+                    s.stack.push_back(ADDRESS);
+                    return;
+
+                case ST: {
+                    uint8_t value = pop(s, offset);
+                    variable(f, s, l, operand_at(bf, offset), scratch) = value;
+                    s.stack.push_back(value);
+                    return;
+                }
+
+                case PATT:
+                    if (x == PATT_BSTRING) {
+                        pop(s, offset);
+                    }
+                    pop(s, offset);
+                    s.stack.push_back(INTEGER);
+                    return;
+
+                default:
+                    break;
+            }
+
+            switch (x) {
+                case BLOCK_CONST:
+                    s.stack.push_back(INTEGER);
+                    break;
+
+                case BLOCK_STRING:
+                    s.stack.push_back(REFERENCE);
+                    break;
+
+                case BLOCK_SEXP:
+                    for (int32_t i = 0; i < operand_at(bf, offset, 1); i++) {
+                        pop(s, offset);
+                    }
+                    s.stack.push_back(REFERENCE);
+                    break;
+
+                case BLOCK_STA: {
+                    uint8_t value = pop(s, offset);
+                    if (pop(s, offset) != ADDRESS) {
+                        pop(s, offset);
+                    }
+                    s.stack.push_back(value);
+                    break;
+                }
+
+                case BLOCK_JMP:
+                case LINE:
+                case BEGIN:
+                case CBEGIN:
+                case CALL_FAIL:
+                    break;
+
+                case BLOCK_END:
+                    update(summaries[f].result, pop(s, offset));
+                    break;
+
+                case BLOCK_DROP:
+                    pop(s, offset);
+                    break;
+
+                case BLOCK_DUP: {
+                    uint8_t value = pop(s, offset);
+                    s.stack.push_back(value);
+                    s.stack.push_back(value);
+                    break;
+                }
+
+                case BLOCK_SWAP: {
+                    uint8_t a = pop(s, offset), b = pop(s, offset);
+                    s.stack.push_back(a);
+                    s.stack.push_back(b);
+                    break;
+                }
+
+                case BLOCK_ELEM:
+                    pop(s, offset);
+                    pop(s, offset);
+                    s.stack.push_back(UNKNOWN);
+                    break;
+
+                case CJMPZ:
+                case CJMPNZ:
+                    record(offset, pop(s, offset));
+                    break;
+
+                case CLOSUSRE:
+                    s.stack.push_back(REFERENCE);
+                    break;
+
+                case CALLC:
+                    for (int32_t i = 0; i <= operand_at(bf, offset); i++) {
+                        pop(s, offset);
+                    }
+                    s.stack.push_back(UNKNOWN);
+                    break;
+
+                case CALL: {
+                    int32_t argc = operand_at(bf, offset, 1);
+                    auto callee = function_at.find(operand_at(bf, offset));
+                    if (argc < 0 || argc > (int32_t) s.stack.size() || callee == function_at.end()) {
+                        failure("TYPING: invalid call at 0x%.8x\n", offset);
+                    }
+                    auto &sum = summaries[callee->second];
+                    for (int32_t i = 0; i < argc && i < (int32_t) sum.args.size(); i++) {
+                        update(sum.args[i], s.stack[s.stack.size() - argc + i]);
+                    }
+                    s.stack.resize(s.stack.size() - argc);
+                    s.stack.push_back(sum.result);
+                    break;
+                }
+
+                case PLACE_TAG:
+                case ARRAY:
+                case CALL_LLENGTH:
+                    pop(s, offset);
+                    s.stack.push_back(INTEGER);
+                    break;
+
+                case CALL_LREAD:
+                    s.stack.push_back(INTEGER);
+                    break;
+
+                case CALL_LWRITE:
+                    pop(s, offset);
+                    s.stack.push_back(INTEGER);
+                    break;
+
+                case CALL_LSRTING:
+                    pop(s, offset);
+                    s.stack.push_back(REFERENCE);
+                    break;
+
+                case CALL_BARRAY:
+                    for (int32_t i = 0; i < operand_at(bf, offset); i++) {
+                        pop(s, offset);
+                    }
+                    s.stack.push_back(REFERENCE);
+                    break;
+
+                default:
+                    failure("TYPING: unsupported instruction at 0x%.8x\n", offset);
+            }
+        }
+
+        void type_analyzer::analyze_function(size_t f) {
+            auto &fn = functions[f];
+            auto &sum = summaries[f];
+
+            std::vector<state> entry(fn.blocks.size());
+            state &start = entry[0];
+            start.reached = true;
+            start.locals.assign(sum.nlocals, UNKNOWN);
+            start.args = sum.escapes ? std::vector<uint8_t>(sum.argc, UNKNOWN) : sum.args;
+
+            std::deque<int32_t> work = {0};
+            std::vector<bool> pending(fn.blocks.size(), false);
+            pending[0] = true;
+            while (!work.empty()) {
+                int32_t b = work.front();
+                work.pop_front();
+                pending[b] = false;
+
+                auto &block = fn.blocks[b];
+                state s = entry[b];
+                for (char *ip = bf->code_ptr + block.begin; ip != nullptr && ip < bf->code_ptr + block.end;) {
+                    transfer(f, ip - bf->code_ptr, s);
+                    ip = disassemble_instruction(nullptr, bf, ip);
+                }
+                for (int32_t succ: block.successors) {
+                    if (entry[succ].join(s, fn.blocks[succ].begin) && !pending[succ]) {
+                        pending[succ] = true;
+                        work.push_back(succ);
+                    }
+                }
+            }
+        }
+
+        std::vector<site> type_analyzer::analyze() {
+            prepare();
+            // summaries only grow, so this terminates
+            do {
+                changed = false;
+                for (size_t f = 0; f < functions.size(); f++) {
+                    analyze_function(f);
+                }
+            } while (changed);
+
+            std::vector<site> sites;
+            for (auto &fn: functions) {
+                for (auto &b: fn.blocks) {
+                    for (char *ip = bf->code_ptr + b.begin; ip != nullptr && ip < bf->code_ptr + b.end;) {
+                        int32_t offset = ip - bf->code_ptr;
+                        auto found = operands.find(offset);
+                        if (found != operands.end()) {
+                            sites.push_back({offset, (uint8_t) *ip, found->second == INTEGER,
+                                             b.reachable ? b.frequency : 0.0});
+                        }
+                        ip = disassemble_instruction(nullptr, bf, ip);
+                    }
+                }
+            }
+            return sites;
+        }
+    }
+
+    std::vector<site> analyze(bytefile *bf, const std::vector<cfg::function> &functions) {
+        return type_analyzer(bf, functions).analyze();
+    }
+
+    void write_report(FILE *f, const std::vector<site> &sites) {
+        const char *names[] = {"BINOP", "CJMP", "total"};
+        size_t count[3] = {}, integer[3] = {};
+        double frequency[3] = {}, integer_frequency[3] = {};
+        for (auto &s: sites) {
+            int group = (s.opcode >> 4) == BINOP ? 0 : 1;
+            for (int g: {group, 2}) {
+                count[g]++;
+                frequency[g] += s.frequency;
+                if (s.integer_operands) {
+                    integer[g]++;
+                    integer_frequency[g] += s.frequency;
+                }
+            }
+        }
+        for (int g = 0; g < 3; g++) {
+            fprintf(f, "%-6s %6zu of %6zu sites with integer operands (%6.2f%%), %6.2f%% of estimated executions\n",
+                    names[g], integer[g], count[g], count[g] == 0 ? 0.0 : 100.0 * integer[g] / count[g],
+                    frequency[g] == 0 ? 0.0 : 100.0 * integer_frequency[g] / frequency[g]);
+        }
+    }
+
+    void write_annotations(FILE *f, bytefile *bf, const std::vector<site> &sites) {
+        fprintf(f, "# lama integer operands of %zu bytes, hash %.16llx\n",
+                bf->file_size, (unsigned long long) file_hash(bf));
+        for (auto &s: sites) {
+            if (s.integer_operands) {
+                fprintf(f, "0x%.8x\t%s\n", s.offset, cfg::describe(bf, s.offset).c_str());
+            }
+        }
+    }
+}